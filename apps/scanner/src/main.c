@@ -19,59 +19,90 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(app, LOG_LEVEL_INF);
 
-#define NAME_LEN 64
+#include "pa_sync.h"
+#include "sink.h"
+#include "source_table.h"
 
-struct bt_scan_recv_info {
-	uint32_t broadcast_id;
-	char broadcast_name[BT_AUDIO_BROADCAST_NAME_LEN_MAX + 1];
-};
-
-static bool broadcast_source_found(struct bt_data *data, void *user_data)
-{
-	struct bt_scan_recv_info *sr_info = (struct bt_scan_recv_info *)user_data;
-	struct bt_uuid_16 adv_uuid;
+#define SCAN_MS_TO_UNITS(_ms) ((_ms) * USEC_PER_MSEC / 625U)
 
-	switch (data->type) {
-	case BT_DATA_SVC_DATA16:
-		if (data->data_len < BT_UUID_SIZE_16 + BT_AUDIO_BROADCAST_ID_SIZE) {
-			return true;
-		}
+BUILD_ASSERT(CONFIG_SCANNER_SCAN_WINDOW_MS <= CONFIG_SCANNER_SCAN_INTERVAL_MS,
+	     "The scan window cannot be longer than the scan interval");
 
-		if (!bt_uuid_create(&adv_uuid.uuid, data->data, BT_UUID_SIZE_16)) {
-			return true;
-		}
+#if defined(CONFIG_SCANNER_ACTIVE_SCAN)
+#define SCAN_TYPE BT_LE_SCAN_TYPE_ACTIVE
+#else
+/* Broadcast sources put everything in their extended advertising data, so scan
+ * requests gain nothing but radio time.
+ */
+#define SCAN_TYPE BT_LE_SCAN_TYPE_PASSIVE
+#endif /* defined(CONFIG_SCANNER_ACTIVE_SCAN) */
 
-		if (bt_uuid_cmp(&adv_uuid.uuid, BT_UUID_BROADCAST_AUDIO) != 0) {
-			return true;
-		}
+#define SCAN_PARAM                                                                                 \
+	BT_LE_SCAN_PARAM(SCAN_TYPE, BT_LE_SCAN_OPT_NONE,                                           \
+			 SCAN_MS_TO_UNITS(CONFIG_SCANNER_SCAN_INTERVAL_MS),                        \
+			 SCAN_MS_TO_UNITS(CONFIG_SCANNER_SCAN_WINDOW_MS))
 
-		sr_info->broadcast_id = sys_get_le24(data->data + BT_UUID_SIZE_16);
-		return true;
-	case BT_DATA_BROADCAST_NAME:
-		if (!IN_RANGE(data->data_len, BT_AUDIO_BROADCAST_NAME_LEN_MIN,
-		    BT_AUDIO_BROADCAST_NAME_LEN_MAX)) {
-			return true;
+static void source_table_changed(enum source_table_event event,
+				 const struct source_table_entry *entry)
+{
+	char addr_str[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(&entry->addr, addr_str, sizeof(addr_str));
+
+	switch (event) {
+	case SOURCE_TABLE_ADDED:
+		LOG_INF("Found broadcast with name %s and id 0x%06x (%s, SID %u, RSSI %d)",
+			entry->broadcast_name, entry->broadcast_id, addr_str, entry->sid,
+			entry->rssi);
+#if defined(CONFIG_SCANNER_PA_SYNC)
+		pa_sync_kick();
+#endif /* defined(CONFIG_SCANNER_PA_SYNC) */
+		break;
+	case SOURCE_TABLE_CHANGED:
+		LOG_INF("Broadcast 0x%06x changed: name %s (%s, SID %u)", entry->broadcast_id,
+			entry->broadcast_name, addr_str, entry->sid);
+		break;
+	case SOURCE_TABLE_REMOVED:
+		LOG_INF("Lost broadcast with name %s and id 0x%06x", entry->broadcast_name,
+			entry->broadcast_id);
+#if defined(CONFIG_SCANNER_SINK)
+		sink_kick();
+#endif /* defined(CONFIG_SCANNER_SINK) */
+		break;
+	case SOURCE_TABLE_BASE_UPDATED:
+		LOG_INF("Broadcast 0x%06x: %u BIS%s, presentation delay %u us, %u subgroups",
+			entry->broadcast_id, entry->base.num_bis,
+			!entry->base.has_biginfo ? " (no BIGInfo)"
+			: entry->base.encrypted  ? ", encrypted"
+						 : "",
+			entry->base.presentation_delay_us, entry->base.subgroup_count);
+		for (uint8_t i = 0U; i < entry->base.subgroup_count; i++) {
+			const struct source_table_subgroup *subgroup = &entry->base.subgroups[i];
+
+			LOG_INF("  Subgroup %u: %u Hz, %u us, %u octets, %u blocks, BIS 0x%08x",
+				i, subgroup->freq_hz, subgroup->frame_duration_us,
+				subgroup->octets_per_frame, subgroup->frame_blocks_per_sdu,
+				subgroup->bis_index_bitfield);
 		}
-
-		utf8_lcpy(sr_info->broadcast_name, data->data, (data->data_len) + 1);
-		return true;
-	default:
-		return true;
+#if defined(CONFIG_SCANNER_SINK)
+		sink_kick();
+#endif /* defined(CONFIG_SCANNER_SINK) */
+		break;
 	}
 }
 
 static void broadcast_scan_recv(const struct bt_le_scan_recv_info *info, struct net_buf_simple *ad)
 {
-	struct bt_scan_recv_info sr_info = { 0 };
-
-	/* We are only interested in non-connectable periodic advertisers */
-	if ((info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE) != 0 ||
+	/* We are only interested in non-connectable periodic advertisers, which use
+	 * extended advertising
+	 */
+	if ((info->adv_props & BT_GAP_ADV_PROP_EXT_ADV) == 0 ||
+	    (info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE) != 0 ||
 	    info->interval == 0) {
 		return;
 	}
 
-	bt_data_parse(ad, broadcast_source_found, (void *)&sr_info);
-	LOG_INF("Found broadcast with name %s and id 0x%06x", sr_info.broadcast_name, sr_info.broadcast_id);
+	source_table_report(info->addr, info->sid, info->rssi, info->interval, ad);
 }
 
 static struct bt_le_scan_cb bap_scan_cb = {
@@ -90,17 +121,31 @@ int main(void)
 
 	LOG_INF("Bluetooth initialized");
 
+	source_table_init(source_table_changed);
 	bt_le_scan_cb_register(&bap_scan_cb);
 
-	LOG_INF("Scanning for broadcast sources");
+	LOG_INF("Scanning for broadcast sources: %s, window %u ms every %u ms",
+		IS_ENABLED(CONFIG_SCANNER_ACTIVE_SCAN) ? "active" : "passive",
+		CONFIG_SCANNER_SCAN_WINDOW_MS, CONFIG_SCANNER_SCAN_INTERVAL_MS);
 
-	err = bt_le_scan_start(BT_LE_SCAN_ACTIVE, NULL);
+	err = bt_le_scan_start(SCAN_PARAM, NULL);
 	if (err != 0 && err != -EALREADY) {
 		LOG_INF("Unable to start scan for broadcast sources: %d",
 				err);
 		return 0;
 	}
 
+#if defined(CONFIG_SCANNER_PA_SYNC)
+	pa_sync_init();
+#endif /* defined(CONFIG_SCANNER_PA_SYNC) */
+
+#if defined(CONFIG_SCANNER_SINK)
+	err = sink_init();
+	if (err != 0) {
+		LOG_ERR("Unable to start the sink: %d", err);
+	}
+#endif /* defined(CONFIG_SCANNER_SINK) */
+
 	k_sleep(K_FOREVER);
 
 	return 0;
@@ -0,0 +1,399 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/audio/audio.h>
+#include <zephyr/bluetooth/audio/bap.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/iso.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(pa_sync, LOG_LEVEL_INF);
+
+#include "pa_sync.h"
+#include "source_table.h"
+
+BUILD_ASSERT(CONFIG_SCANNER_PA_SYNC_MAX <= CONFIG_BT_PER_ADV_SYNC_MAX,
+	     "CONFIG_BT_PER_ADV_SYNC_MAX shall be at least CONFIG_SCANNER_PA_SYNC_MAX");
+
+/* How often sources without BASE are looked for, besides pa_sync_kick() */
+#define KICK_INTERVAL_MS 1000
+/* Sync timeout as a number of PA intervals */
+#define PA_SYNC_INTERVAL_TO_TIMEOUT_RATIO 5
+/* A source that could not be read is not tried again for this long */
+#define BASE_RETRY_MS (4 * CONFIG_SCANNER_BASE_TIMEOUT_MS)
+
+struct pa_sync_slot {
+	struct bt_le_per_adv_sync *sync;
+	/* The sync has been established, until then its create is pending in the host */
+	bool synced;
+	uint32_t broadcast_id;
+	struct source_table_base base;
+	/* Ends the sync once the BASE and BIGInfo are in, or on timeout */
+	struct k_work_delayable done_work;
+};
+
+static struct pa_sync_slot slots[CONFIG_SCANNER_PA_SYNC_MAX];
+static K_MUTEX_DEFINE(slots_lock);
+
+static void kick_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(kick_work, kick_handler);
+
+static struct pa_sync_slot *slot_find_sync(const struct bt_le_per_adv_sync *sync)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].sync != NULL && slots[i].sync == sync) {
+			return &slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Called by source_table_base_claim() from kick_handler(), the only place slots are taken */
+static bool broadcast_id_busy(uint32_t broadcast_id)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].sync != NULL && slots[i].broadcast_id == broadcast_id) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static uint16_t interval_to_sync_timeout(uint16_t interval)
+{
+	/* PA interval in 1.25 ms units, sync timeout in 10 ms units */
+	const uint32_t timeout = DIV_ROUND_UP((uint32_t)interval * 1250U, 10000U) *
+				 PA_SYNC_INTERVAL_TO_TIMEOUT_RATIO;
+
+	return CLAMP(timeout, BT_GAP_PER_ADV_MIN_TIMEOUT, BT_GAP_PER_ADV_MAX_TIMEOUT);
+}
+
+/* Called with slots_lock held */
+static void slot_release(struct pa_sync_slot *slot)
+{
+	slot->sync = NULL;
+	(void)memset(&slot->base, 0, sizeof(slot->base));
+	pa_sync_kick();
+}
+
+static void done_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct pa_sync_slot *slot = CONTAINER_OF(dwork, struct pa_sync_slot, done_work);
+	struct bt_le_per_adv_sync *sync;
+	struct source_table_base base;
+	uint32_t broadcast_id;
+	int err;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	sync = slot->sync;
+	base = slot->base;
+	broadcast_id = slot->broadcast_id;
+	if (sync != NULL) {
+		slot_release(slot);
+	}
+	k_mutex_unlock(&slots_lock);
+
+	if (sync == NULL) {
+		/* Sync lost in the meantime */
+		return;
+	}
+
+	/* Outside of the lock: the PA callbacks taking it run in the thread completing
+	 * HCI commands.
+	 */
+	err = bt_le_per_adv_sync_delete(sync);
+	if (err != 0) {
+		LOG_WRN("Unable to delete PA sync of 0x%06x: %d", broadcast_id, err);
+	}
+
+	if (!base.valid) {
+		LOG_INF("No BASE from broadcast 0x%06x", broadcast_id);
+		return;
+	}
+
+	(void)source_table_base_set(broadcast_id, &base);
+}
+
+static int pa_sync_start(const struct source_table_entry *entry, struct pa_sync_slot *slot)
+{
+	struct bt_le_per_adv_sync_param param = {0};
+	struct bt_le_per_adv_sync *sync;
+	int err;
+
+	bt_addr_le_copy(&param.addr, &entry->addr);
+	param.sid = entry->sid;
+	param.options = BT_LE_PER_ADV_SYNC_OPT_NONE;
+	param.skip = 0U;
+	param.timeout = interval_to_sync_timeout(entry->interval);
+
+	err = bt_le_per_adv_sync_create(&param, &sync);
+	if (err != 0) {
+		return err;
+	}
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	slot->broadcast_id = entry->broadcast_id;
+	(void)memset(&slot->base, 0, sizeof(slot->base));
+	slot->sync = sync;
+	slot->synced = false;
+	(void)k_work_reschedule(&slot->done_work, K_MSEC(CONFIG_SCANNER_BASE_TIMEOUT_MS));
+	k_mutex_unlock(&slots_lock);
+
+	LOG_DBG("Syncing to broadcast 0x%06x", entry->broadcast_id);
+
+	return 0;
+}
+
+/* Slots are only taken from the system workqueue, so a slot seen free here stays free
+ * until pa_sync_start() takes it.
+ *
+ * The host has a single PA sync create pending at a time and fails any other with -EBUSY,
+ * so one sync is started per kick. The next one is kicked once it is established or has
+ * failed, and the slots are read in parallel from then on.
+ */
+static void kick_handler(struct k_work *work)
+{
+	struct pa_sync_slot *slot = NULL;
+	struct source_table_entry entry;
+	int err;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].sync != NULL && !slots[i].synced) {
+			slot = NULL;
+			break;
+		}
+
+		if (slots[i].sync == NULL && slot == NULL) {
+			slot = &slots[i];
+		}
+	}
+	k_mutex_unlock(&slots_lock);
+
+	if (slot != NULL && source_table_base_claim(&entry, broadcast_id_busy, BASE_RETRY_MS)) {
+		err = pa_sync_start(&entry, slot);
+		if (err != 0) {
+			/* -EBUSY while the sink syncs, retried once that one is done */
+			if (err != -EBUSY) {
+				LOG_WRN("Unable to sync to broadcast 0x%06x: %d", entry.broadcast_id,
+					err);
+			}
+			source_table_base_unclaim(entry.broadcast_id);
+		}
+	}
+
+	(void)k_work_reschedule(&kick_work, K_MSEC(KICK_INTERVAL_MS));
+}
+
+static bool base_bis_parse(const struct bt_bap_base_subgroup_bis *bis, void *user_data)
+{
+	struct bt_audio_codec_cfg codec_cfg = {0};
+	enum bt_audio_location location;
+	int err;
+
+	err = bt_bap_base_subgroup_bis_codec_to_codec_cfg(bis, &codec_cfg);
+	if (err == 0) {
+		err = bt_audio_codec_cfg_get_chan_allocation(&codec_cfg, &location, false);
+	}
+
+	if (err == 0) {
+		LOG_DBG("  BIS %u: location 0x%08x", bis->index, location);
+	} else {
+		LOG_DBG("  BIS %u: no location", bis->index);
+	}
+
+	return true;
+}
+
+static bool base_subgroup_parse(const struct bt_bap_base_subgroup *subgroup, void *user_data)
+{
+	struct source_table_base *base = user_data;
+	struct source_table_subgroup *info;
+	struct bt_audio_codec_cfg codec_cfg = {0};
+	int ret;
+
+	if (base->subgroup_count >= ARRAY_SIZE(base->subgroups)) {
+		LOG_DBG("Only the first %zu subgroups are stored", ARRAY_SIZE(base->subgroups));
+		return false;
+	}
+
+	info = &base->subgroups[base->subgroup_count++];
+
+	ret = bt_bap_base_subgroup_get_bis_indexes(subgroup, &info->bis_index_bitfield);
+	if (ret != 0) {
+		return true;
+	}
+
+	ret = bt_bap_base_subgroup_codec_to_codec_cfg(subgroup, &codec_cfg);
+	if (ret != 0 || codec_cfg.id != BT_HCI_CODING_FORMAT_LC3) {
+		/* Not LC3: only the BIS indexes can be reported */
+		return true;
+	}
+
+	ret = bt_audio_codec_cfg_get_freq(&codec_cfg);
+	if (ret >= 0) {
+		ret = bt_audio_codec_cfg_freq_to_freq_hz(ret);
+		info->freq_hz = MAX(ret, 0);
+	}
+
+	ret = bt_audio_codec_cfg_get_frame_dur(&codec_cfg);
+	if (ret >= 0) {
+		ret = bt_audio_codec_cfg_frame_dur_to_frame_dur_us(ret);
+		info->frame_duration_us = MAX(ret, 0);
+	}
+
+	ret = bt_audio_codec_cfg_get_octets_per_frame(&codec_cfg);
+	info->octets_per_frame = MAX(ret, 0);
+
+	ret = bt_audio_codec_cfg_get_frame_blocks_per_sdu(&codec_cfg, true);
+	info->frame_blocks_per_sdu = MAX(ret, 0);
+
+	(void)bt_bap_base_subgroup_foreach_bis(subgroup, base_bis_parse, NULL);
+
+	return true;
+}
+
+static bool base_found(struct bt_data *data, void *user_data)
+{
+	struct source_table_base *base = user_data;
+	const struct bt_bap_base *bap_base;
+	int ret;
+
+	bap_base = bt_bap_base_get_base_from_ad(data);
+	if (bap_base == NULL) {
+		return true;
+	}
+
+	ret = bt_bap_base_get_pres_delay(bap_base);
+	if (ret < 0) {
+		return true;
+	}
+
+	base->presentation_delay_us = ret;
+	base->subgroup_count = 0U;
+	(void)bt_bap_base_foreach_subgroup(bap_base, base_subgroup_parse, base);
+	base->valid = true;
+
+	return false;
+}
+
+static void pa_synced(struct bt_le_per_adv_sync *sync,
+		      struct bt_le_per_adv_sync_synced_info *info)
+{
+	struct pa_sync_slot *slot;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	slot = slot_find_sync(sync);
+	if (slot != NULL) {
+		slot->synced = true;
+	}
+	k_mutex_unlock(&slots_lock);
+
+	/* The PA sync create is no longer pending, whether it was ours or the sink's */
+	pa_sync_kick();
+}
+
+static void pa_recv(struct bt_le_per_adv_sync *sync,
+		    const struct bt_le_per_adv_sync_recv_info *info, struct net_buf_simple *buf)
+{
+	struct source_table_base base = {0};
+	struct pa_sync_slot *slot;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	slot = slot_find_sync(sync);
+	if (slot == NULL || slot->base.valid) {
+		k_mutex_unlock(&slots_lock);
+		return;
+	}
+	k_mutex_unlock(&slots_lock);
+
+	bt_data_parse(buf, base_found, &base);
+	if (!base.valid) {
+		return;
+	}
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	if (slot->sync == sync) {
+		base.has_biginfo = slot->base.has_biginfo;
+		base.encrypted = slot->base.encrypted;
+		base.num_bis = slot->base.num_bis;
+		slot->base = base;
+
+		if (base.has_biginfo) {
+			(void)k_work_reschedule(&slot->done_work, K_NO_WAIT);
+		}
+	}
+	k_mutex_unlock(&slots_lock);
+}
+
+static void pa_biginfo(struct bt_le_per_adv_sync *sync, const struct bt_iso_biginfo *biginfo)
+{
+	struct pa_sync_slot *slot;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	slot = slot_find_sync(sync);
+	if (slot != NULL && !slot->base.has_biginfo) {
+		slot->base.has_biginfo = true;
+		slot->base.encrypted = biginfo->encryption;
+		slot->base.num_bis = biginfo->num_bis;
+
+		if (slot->base.valid) {
+			(void)k_work_reschedule(&slot->done_work, K_NO_WAIT);
+		}
+	}
+	k_mutex_unlock(&slots_lock);
+}
+
+static void pa_term(struct bt_le_per_adv_sync *sync,
+		    const struct bt_le_per_adv_sync_term_info *info)
+{
+	struct pa_sync_slot *slot;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	slot = slot_find_sync(sync);
+	if (slot != NULL) {
+		LOG_INF("PA sync to broadcast 0x%06x lost: 0x%02x", slot->broadcast_id,
+			info->reason);
+		(void)k_work_cancel_delayable(&slot->done_work);
+		slot_release(slot);
+	}
+	k_mutex_unlock(&slots_lock);
+
+	/* Also ends a pending PA sync create that failed */
+	pa_sync_kick();
+}
+
+static struct bt_le_per_adv_sync_cb pa_sync_cb = {
+	.synced = pa_synced,
+	.recv = pa_recv,
+	.biginfo = pa_biginfo,
+	.term = pa_term,
+};
+
+void pa_sync_kick(void)
+{
+	(void)k_work_reschedule(&kick_work, K_NO_WAIT);
+}
+
+void pa_sync_init(void)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		k_work_init_delayable(&slots[i].done_work, done_handler);
+	}
+
+	bt_le_per_adv_sync_cb_register(&pa_sync_cb);
+	pa_sync_kick();
+}
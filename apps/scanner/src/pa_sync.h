@@ -0,0 +1,22 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PA_SYNC_H_
+#define PA_SYNC_H_
+
+/**
+ * Register the periodic advertising callbacks and start looking for sources of the
+ * source table whose BASE is still unknown.
+ *
+ * Up to CONFIG_SCANNER_PA_SYNC_MAX sources are synced to at once, their syncs being created
+ * one after the other as the host only allows one pending create. The sync to a source is
+ * terminated as soon as its BASE and BIGInfo have been read, or after at most
+ * CONFIG_SCANNER_BASE_TIMEOUT_MS, and the result stored with source_table_base_set().
+ */
+void pa_sync_init(void);
+
+/** Look for sources to sync to right away, e.g. when a source was added to the table */
+void pa_sync_kick(void);
+
+#endif /* PA_SYNC_H_ */
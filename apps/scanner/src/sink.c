@@ -0,0 +1,705 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <lc3.h>
+
+#include <zephyr/bluetooth/audio/audio.h>
+#include <zephyr/bluetooth/audio/bap.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/iso.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/i2s.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(sink, LOG_LEVEL_INF);
+
+#include "sink.h"
+#include "source_table.h"
+
+#define I2S_NODE DT_ALIAS(i2s_sink)
+#if !DT_NODE_HAS_STATUS(I2S_NODE, okay)
+#error "The board has no enabled I2S device with the i2s-sink alias"
+#endif
+
+#define SINK_STREAM_COUNT CONFIG_BT_BAP_BROADCAST_SNK_STREAM_COUNT
+/* The I2S output is always stereo, a single received channel is played on both sides */
+#define SINK_CHANNELS     2
+
+#define SINK_MAX_SAMPLE_RATE       48000
+#define SINK_MAX_FRAME_DURATION_US 10000
+#define SINK_MAX_SAMPLES           ((SINK_MAX_FRAME_DURATION_US * SINK_MAX_SAMPLE_RATE) / USEC_PER_SEC)
+#define SINK_MAX_SDU               CONFIG_BT_ISO_RX_MTU
+
+/* The jitter buffer is indexed with the SDU sequence number, which wraps at 2^16 */
+#define JITTER_SDUS CONFIG_SCANNER_SINK_JITTER_MAX_SDUS
+BUILD_ASSERT(IS_POWER_OF_TWO(JITTER_SDUS), "CONFIG_SCANNER_SINK_JITTER_MAX_SDUS shall be a power of two");
+
+#define JITTER_MIN_DEPTH 2U
+
+#define I2S_BLOCK_MAX_BYTES (SINK_MAX_SAMPLES * SINK_CHANNELS * sizeof(int16_t))
+/* Blocks queued to the I2S driver before it is started, out of I2S_BLOCK_COUNT */
+#define I2S_PREFILL_BLOCKS  2U
+#define I2S_BLOCK_COUNT     4U
+
+#define DECODER_STACK_SIZE 2 * 4096
+#define DECODER_PRIORITY   5
+
+#define STATS_LOG_INTERVAL_FRAMES 1000U
+
+/* The PA sync create is retried after this long when the BASE reads have one pending */
+#define PA_SYNC_RETRY_MS 100
+
+typedef LC3_DECODER_MEM_T(SINK_MAX_FRAME_DURATION_US, SINK_MAX_SAMPLE_RATE) sink_lc3_decoder_mem_t;
+
+enum sink_state {
+	SINK_IDLE,
+	/* Waiting for the PA sync to the selected source */
+	SINK_PA_SYNCING,
+	/* Waiting for the BASE and BIGInfo of the source */
+	SINK_BIG_WAITING,
+	/* BIG sync requested, until all streams have started */
+	SINK_BIG_SYNCING,
+	SINK_STREAMING,
+};
+
+/* Events from the Bluetooth callbacks, handled by sink_handler() */
+enum sink_flag {
+	/* PA sync to the source is gone */
+	SINK_FLAG_PA_LOST,
+	/* The BASE and BIGInfo of the source have been received */
+	SINK_FLAG_SYNCABLE,
+	/* A stream stopped, tear the sink down */
+	SINK_FLAG_RESET,
+
+	SINK_FLAG_COUNT,
+};
+
+struct jitter_slot {
+	uint16_t seq_num;
+	bool filled;
+	uint16_t len;
+	uint8_t data[SINK_MAX_SDU];
+};
+
+struct sink_stream {
+	struct bt_bap_stream stream;
+	/* Frames per SDU, one per channel of the BIS */
+	uint8_t channels;
+	bool receiving;
+	/* Newest sequence number received */
+	uint16_t newest_seq;
+	struct jitter_slot jitter[JITTER_SDUS];
+};
+
+/* Where a decoded output channel comes from */
+struct sink_channel {
+	struct sink_stream *stream;
+	uint8_t frame;
+};
+
+static const struct device *const i2s_dev = DEVICE_DT_GET(I2S_NODE);
+K_MEM_SLAB_DEFINE_STATIC(i2s_slab, I2S_BLOCK_MAX_BYTES, I2S_BLOCK_COUNT, 4);
+
+static struct sink_stream streams[SINK_STREAM_COUNT];
+
+/* Only changed by sink_handler(), the Bluetooth callbacks report through sink_flags */
+static struct {
+	enum sink_state state;
+	struct source_table_entry source;
+	struct source_table_subgroup subgroup;
+	uint32_t bis_index_bitfield;
+	size_t stream_count;
+	struct bt_le_per_adv_sync *pa_sync;
+	struct bt_bap_broadcast_sink *broadcast_sink;
+} sink;
+static ATOMIC_DEFINE(sink_flags, SINK_FLAG_COUNT);
+static atomic_t started_count;
+
+/* Protects the jitter buffers and the playback position against the receive callback */
+static struct k_spinlock jitter_lock;
+static bool playing;
+static uint16_t play_seq;
+static struct sink_stats stats;
+
+static atomic_t streaming;
+static K_SEM_DEFINE(playback_sem, 0U, 1U);
+
+static lc3_decoder_t lc3_decoder[SINK_CHANNELS];
+static sink_lc3_decoder_mem_t lc3_decoder_mem[SINK_CHANNELS];
+
+static void sink_handler(struct k_work *work);
+static K_WORK_DEFINE(sink_work, sink_handler);
+
+static void sink_retry_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(sink_retry_work, sink_retry_handler);
+
+static bool frame_duration_supported(uint32_t frame_duration_us)
+{
+	return frame_duration_us == 7500U || frame_duration_us == 10000U;
+}
+
+static const struct source_table_subgroup *playable_subgroup(const struct source_table_base *base)
+{
+	for (uint8_t i = 0U; i < base->subgroup_count; i++) {
+		const struct source_table_subgroup *subgroup = &base->subgroups[i];
+
+		if (subgroup->freq_hz != 0U && subgroup->freq_hz <= SINK_MAX_SAMPLE_RATE &&
+		    frame_duration_supported(subgroup->frame_duration_us) &&
+		    subgroup->octets_per_frame != 0U && subgroup->frame_blocks_per_sdu != 0U &&
+		    subgroup->bis_index_bitfield != 0U) {
+			return subgroup;
+		}
+	}
+
+	return NULL;
+}
+
+static bool source_playable(const struct source_table_entry *entry)
+{
+	/* Encrypted sources would need a Broadcast Code, which the sink has no way to get */
+	return entry->base.valid && entry->base.has_biginfo && !entry->base.encrypted &&
+	       playable_subgroup(&entry->base) != NULL;
+}
+
+/* Keep the lowest BIS indexes, as many as there are streams */
+static uint32_t bis_index_bitfield_limit(uint32_t bitfield)
+{
+	uint32_t limited = 0U;
+
+	for (size_t i = 0U; i < SINK_STREAM_COUNT && bitfield != 0U; i++) {
+		const uint32_t lowest = bitfield & (~bitfield + 1U);
+
+		limited |= lowest;
+		bitfield &= ~lowest;
+	}
+
+	return limited;
+}
+
+static void sink_reset(void)
+{
+	int err;
+
+	atomic_clear(&streaming);
+
+	if (sink.broadcast_sink != NULL) {
+		if (sink.state >= SINK_BIG_SYNCING) {
+			(void)bt_bap_broadcast_sink_stop(sink.broadcast_sink);
+		}
+
+		err = bt_bap_broadcast_sink_delete(sink.broadcast_sink);
+		if (err != 0) {
+			LOG_WRN("Unable to delete broadcast sink: %d", err);
+		}
+		sink.broadcast_sink = NULL;
+	}
+
+	if (sink.pa_sync != NULL) {
+		(void)bt_le_per_adv_sync_delete(sink.pa_sync);
+		sink.pa_sync = NULL;
+	}
+
+	sink.state = SINK_IDLE;
+	atomic_clear_bit(sink_flags, SINK_FLAG_SYNCABLE);
+	atomic_clear_bit(sink_flags, SINK_FLAG_RESET);
+	atomic_clear(&started_count);
+}
+
+/* For the Bluetooth callbacks, which shall not send HCI commands themselves */
+static void sink_flag_raise(enum sink_flag flag)
+{
+	atomic_set_bit(sink_flags, flag);
+	k_work_submit(&sink_work);
+}
+
+static void sink_pa_sync(void)
+{
+	struct bt_le_per_adv_sync_param param = {0};
+	int err;
+
+	if (!source_table_best(&sink.source, source_playable)) {
+		return;
+	}
+
+	sink.subgroup = *playable_subgroup(&sink.source.base);
+	sink.bis_index_bitfield = bis_index_bitfield_limit(sink.subgroup.bis_index_bitfield);
+	sink.stream_count = POPCOUNT(sink.bis_index_bitfield);
+
+	bt_addr_le_copy(&param.addr, &sink.source.addr);
+	param.sid = sink.source.sid;
+	param.options = BT_LE_PER_ADV_SYNC_OPT_NONE;
+	/* Sync timeout of about 5 PA intervals, in 10 ms units */
+	param.timeout = CLAMP(DIV_ROUND_UP((uint32_t)sink.source.interval * 1250U * 5U, 10000U),
+			      BT_GAP_PER_ADV_MIN_TIMEOUT, BT_GAP_PER_ADV_MAX_TIMEOUT);
+
+	err = bt_le_per_adv_sync_create(&param, &sink.pa_sync);
+	if (err == -EBUSY) {
+		/* The host has a single PA sync create pending at a time, pa_sync.c has it */
+		sink.pa_sync = NULL;
+		(void)k_work_reschedule(&sink_retry_work, K_MSEC(PA_SYNC_RETRY_MS));
+		return;
+	}
+
+	if (err != 0) {
+		LOG_WRN("Unable to sync to broadcast 0x%06x: %d", sink.source.broadcast_id, err);
+		sink.pa_sync = NULL;
+		return;
+	}
+
+	LOG_INF("Playing broadcast %s (0x%06x): %u Hz, %u us, %u blocks per SDU, BIS 0x%08x",
+		sink.source.broadcast_name, sink.source.broadcast_id, sink.subgroup.freq_hz,
+		sink.subgroup.frame_duration_us, sink.subgroup.frame_blocks_per_sdu,
+		sink.bis_index_bitfield);
+
+	sink.state = SINK_PA_SYNCING;
+}
+
+static void sink_big_sync(void)
+{
+	struct bt_bap_stream *bap_streams[SINK_STREAM_COUNT];
+	int err;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(bap_streams); i++) {
+		bap_streams[i] = &streams[i].stream;
+	}
+
+	err = bt_bap_broadcast_sink_sync(sink.broadcast_sink, sink.bis_index_bitfield, bap_streams,
+					 NULL);
+	if (err != 0) {
+		LOG_WRN("Unable to sync to BIG: %d", err);
+		sink_reset();
+		return;
+	}
+
+	sink.state = SINK_BIG_SYNCING;
+}
+
+/* Runs the sink state machine on the system workqueue, where HCI commands may block */
+static void sink_handler(struct k_work *work)
+{
+	int err;
+
+	if (atomic_test_and_clear_bit(sink_flags, SINK_FLAG_PA_LOST)) {
+		/* The sync object is gone already */
+		sink.pa_sync = NULL;
+
+		/* Once streaming the BIG does not need the periodic advertising anymore */
+		if (sink.state != SINK_STREAMING) {
+			sink_reset();
+		}
+	}
+
+	if (atomic_test_bit(sink_flags, SINK_FLAG_RESET)) {
+		sink_reset();
+	}
+
+	switch (sink.state) {
+	case SINK_IDLE:
+		sink_pa_sync();
+		break;
+	case SINK_PA_SYNCING:
+		if (sink.broadcast_sink != NULL) {
+			break;
+		}
+
+		err = bt_bap_broadcast_sink_create(sink.pa_sync, sink.source.broadcast_id,
+						   &sink.broadcast_sink);
+		if (err != 0) {
+			LOG_WRN("Unable to create broadcast sink: %d", err);
+			sink.broadcast_sink = NULL;
+			sink_reset();
+			break;
+		}
+
+		sink.state = SINK_BIG_WAITING;
+		/* The source may already be syncable */
+		__fallthrough;
+	case SINK_BIG_WAITING:
+		if (atomic_test_bit(sink_flags, SINK_FLAG_SYNCABLE)) {
+			sink_big_sync();
+		}
+		break;
+	case SINK_BIG_SYNCING:
+		if (atomic_get(&streaming)) {
+			sink.state = SINK_STREAMING;
+		}
+		break;
+	case SINK_STREAMING:
+		break;
+	}
+}
+
+static void sink_retry_handler(struct k_work *work)
+{
+	k_work_submit(&sink_work);
+}
+
+static void pa_synced(struct bt_le_per_adv_sync *sync,
+		      struct bt_le_per_adv_sync_synced_info *info)
+{
+	if (sync == sink.pa_sync) {
+		k_work_submit(&sink_work);
+	}
+}
+
+static void pa_term(struct bt_le_per_adv_sync *sync,
+		    const struct bt_le_per_adv_sync_term_info *info)
+{
+	if (sync != sink.pa_sync) {
+		return;
+	}
+
+	LOG_INF("PA sync to broadcast 0x%06x lost: 0x%02x", sink.source.broadcast_id,
+		info->reason);
+	sink_flag_raise(SINK_FLAG_PA_LOST);
+}
+
+static struct bt_le_per_adv_sync_cb pa_sync_cb = {
+	.synced = pa_synced,
+	.term = pa_term,
+};
+
+static void sink_syncable(struct bt_bap_broadcast_sink *broadcast_sink,
+			  const struct bt_iso_biginfo *biginfo)
+{
+	if (broadcast_sink == sink.broadcast_sink &&
+	    !atomic_test_bit(sink_flags, SINK_FLAG_SYNCABLE)) {
+		sink_flag_raise(SINK_FLAG_SYNCABLE);
+	}
+}
+
+static struct bt_bap_broadcast_sink_cb broadcast_sink_cb = {
+	.syncable = sink_syncable,
+};
+
+static void stream_started(struct bt_bap_stream *stream)
+{
+	struct sink_stream *sink_stream = CONTAINER_OF(stream, struct sink_stream, stream);
+	enum bt_audio_location location;
+	k_spinlock_key_t key;
+
+	if (bt_audio_codec_cfg_get_chan_allocation(stream->codec_cfg, &location, true) != 0) {
+		location = BT_AUDIO_LOCATION_MONO_AUDIO;
+	}
+
+	key = k_spin_lock(&jitter_lock);
+	sink_stream->channels = MAX(bt_audio_get_chan_count(location), 1);
+	sink_stream->receiving = false;
+	for (size_t i = 0U; i < ARRAY_SIZE(sink_stream->jitter); i++) {
+		sink_stream->jitter[i].filled = false;
+	}
+	k_spin_unlock(&jitter_lock, key);
+
+	if (atomic_inc(&started_count) + 1 == (atomic_val_t)sink.stream_count) {
+		atomic_set(&streaming, 1);
+		k_sem_give(&playback_sem);
+		k_work_submit(&sink_work);
+	}
+}
+
+static void stream_stopped(struct bt_bap_stream *stream, uint8_t reason)
+{
+	LOG_INF("Stream %p stopped: 0x%02x", stream, reason);
+
+	atomic_clear(&streaming);
+	sink_flag_raise(SINK_FLAG_RESET);
+}
+
+static void stream_recv(struct bt_bap_stream *stream, const struct bt_iso_recv_info *info,
+			struct net_buf *buf)
+{
+	struct sink_stream *sink_stream = CONTAINER_OF(stream, struct sink_stream, stream);
+	struct jitter_slot *slot;
+	k_spinlock_key_t key;
+
+	/* Lost or invalid SDUs are left out of the jitter buffer, and concealed when due */
+	if ((info->flags & BT_ISO_FLAGS_VALID) == 0 || buf->len == 0U || buf->len > SINK_MAX_SDU) {
+		return;
+	}
+
+	key = k_spin_lock(&jitter_lock);
+	if (playing && (int16_t)(info->seq_num - play_seq) < 0) {
+		stats.late++;
+		k_spin_unlock(&jitter_lock, key);
+		return;
+	}
+
+	slot = &sink_stream->jitter[info->seq_num % JITTER_SDUS];
+	slot->seq_num = info->seq_num;
+	slot->len = buf->len;
+	slot->filled = true;
+	(void)memcpy(slot->data, buf->data, buf->len);
+
+	if (!sink_stream->receiving || (int16_t)(info->seq_num - sink_stream->newest_seq) > 0) {
+		sink_stream->newest_seq = info->seq_num;
+	}
+	sink_stream->receiving = true;
+	stats.received++;
+	k_spin_unlock(&jitter_lock, key);
+}
+
+static struct bt_bap_stream_ops stream_ops = {
+	.started = stream_started,
+	.stopped = stream_stopped,
+	.recv = stream_recv,
+};
+
+/*
+ * Get the frame of an output channel for the current playback position.
+ *
+ * SDUs hold the frames of all channels of the BIS for each frame block in turn.
+ *
+ * @param block Frame block of the SDU being played
+ *
+ * @return Length of the frame copied to @p frame, 0 if it is missing.
+ */
+static size_t frame_take(const struct sink_channel *channel, uint8_t block,
+			 uint16_t octets_per_frame, uint8_t frame[SINK_MAX_SDU])
+{
+	struct jitter_slot *slot = &channel->stream->jitter[play_seq % JITTER_SDUS];
+	const size_t offset =
+		((size_t)block * channel->stream->channels + channel->frame) * octets_per_frame;
+	size_t len = 0U;
+
+	if (slot->filled && slot->seq_num == play_seq && slot->len >= offset + octets_per_frame) {
+		(void)memcpy(frame, &slot->data[offset], octets_per_frame);
+		len = octets_per_frame;
+	}
+
+	return len;
+}
+
+/* Map the first two received channels to the stereo output, in BIS index order */
+static size_t channels_map(struct sink_channel channels[SINK_CHANNELS])
+{
+	size_t count = 0U;
+
+	for (size_t i = 0U; i < sink.stream_count && count < SINK_CHANNELS; i++) {
+		for (uint8_t j = 0U; j < streams[i].channels && count < SINK_CHANNELS; j++) {
+			channels[count].stream = &streams[i];
+			channels[count].frame = j;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static int playback_start(uint32_t freq_hz, size_t block_bytes, uint32_t frame_duration_us)
+{
+	struct i2s_config cfg = {
+		.word_size = 16U,
+		.channels = SINK_CHANNELS,
+		.format = I2S_FMT_DATA_FORMAT_I2S,
+		.options = I2S_OPT_BIT_CLK_MASTER | I2S_OPT_FRAME_CLK_MASTER,
+		.frame_clk_freq = freq_hz,
+		.mem_slab = &i2s_slab,
+		.block_size = block_bytes,
+		/* A block is consumed every frame, two frames means the clock stopped */
+		.timeout = DIV_ROUND_UP(2U * frame_duration_us, USEC_PER_MSEC),
+	};
+
+	return i2s_configure(i2s_dev, I2S_DIR_TX, &cfg);
+}
+
+/**
+ * Play the streams until they stop.
+ *
+ * @return 0 if the streams stopped, negative errno if playback failed while streaming.
+ */
+static int playback_run(void)
+{
+	const uint32_t freq_hz = sink.subgroup.freq_hz;
+	const uint32_t frame_duration_us = sink.subgroup.frame_duration_us;
+	const uint16_t octets_per_frame = sink.subgroup.octets_per_frame;
+	const uint8_t blocks = sink.subgroup.frame_blocks_per_sdu;
+	const uint32_t sdu_interval_us = blocks * frame_duration_us;
+	const size_t num_samples = (frame_duration_us * freq_hz) / USEC_PER_SEC;
+	const size_t block_bytes = num_samples * SINK_CHANNELS * sizeof(int16_t);
+	/* Buffer the presentation delay worth of SDUs, as the source expects */
+	const uint16_t depth =
+		CLAMP(DIV_ROUND_UP(sink.source.base.presentation_delay_us, sdu_interval_us),
+		      JITTER_MIN_DEPTH, JITTER_SDUS / 2U);
+	struct sink_channel channels[SINK_CHANNELS];
+	uint8_t frame[SINK_MAX_SDU];
+	size_t channel_count;
+	size_t frames_played = 0U;
+	k_spinlock_key_t key;
+	int err;
+
+	for (size_t i = 0U; i < SINK_CHANNELS; i++) {
+		lc3_decoder[i] = lc3_setup_decoder(frame_duration_us, freq_hz, 0, &lc3_decoder_mem[i]);
+		if (lc3_decoder[i] == NULL) {
+			LOG_ERR("Failed to setup LC3 decoder - wrong parameters?");
+			return -EINVAL;
+		}
+	}
+
+	err = playback_start(freq_hz, block_bytes, frame_duration_us);
+	if (err != 0) {
+		LOG_ERR("Unable to configure I2S: %d", err);
+		return err;
+	}
+
+	channel_count = channels_map(channels);
+
+	/* Fill the jitter buffer before playing from it */
+	while (atomic_get(&streaming) && !channels[0].stream->receiving) {
+		k_sleep(K_USEC(sdu_interval_us));
+	}
+	k_sleep(K_USEC(depth * sdu_interval_us));
+
+	key = k_spin_lock(&jitter_lock);
+	play_seq = channels[0].stream->newest_seq - depth + 1U;
+	playing = true;
+	k_spin_unlock(&jitter_lock, key);
+
+	LOG_INF("Playback started with %u SDUs of jitter buffer", depth);
+
+	err = 0;
+	while (atomic_get(&streaming) && err == 0) {
+		/* Each I2S block plays one frame block of the SDU */
+		for (uint8_t b = 0U; b < blocks; b++) {
+			void *block;
+
+			err = k_mem_slab_alloc(&i2s_slab, &block, K_USEC(2U * frame_duration_us));
+			if (err != 0) {
+				LOG_WRN("No I2S block: %d", err);
+				break;
+			}
+
+			for (size_t i = 0U; i < SINK_CHANNELS; i++) {
+				const struct sink_channel *channel =
+					&channels[MIN(i, channel_count - 1U)];
+				size_t len;
+
+				key = k_spin_lock(&jitter_lock);
+				len = frame_take(channel, b, octets_per_frame, frame);
+				if (len == 0U) {
+					stats.lost++;
+				}
+				k_spin_unlock(&jitter_lock, key);
+
+				/* A NULL frame makes the decoder conceal the loss */
+				(void)lc3_decode(lc3_decoder[i], len != 0U ? frame : NULL,
+						 octets_per_frame, LC3_PCM_FORMAT_S16,
+						 &((int16_t *)block)[i], SINK_CHANNELS);
+			}
+
+			err = i2s_write(i2s_dev, block, block_bytes);
+			if (err != 0) {
+				LOG_WRN("I2S write failed: %d", err);
+				k_mem_slab_free(&i2s_slab, block);
+				break;
+			}
+
+			frames_played++;
+			if (frames_played == I2S_PREFILL_BLOCKS) {
+				err = i2s_trigger(i2s_dev, I2S_DIR_TX, I2S_TRIGGER_START);
+				if (err != 0) {
+					LOG_ERR("Unable to start I2S: %d", err);
+					break;
+				}
+			}
+		}
+
+		if (err != 0) {
+			break;
+		}
+
+		key = k_spin_lock(&jitter_lock);
+		for (size_t i = 0U; i < channel_count; i++) {
+			channels[i].stream->jitter[play_seq % JITTER_SDUS].filled = false;
+		}
+		play_seq++;
+		/* The source clock running faster than the I2S one ends up here */
+		if ((int16_t)(channels[0].stream->newest_seq - play_seq) >= (int16_t)JITTER_SDUS) {
+			play_seq = channels[0].stream->newest_seq - depth + 1U;
+			stats.resyncs++;
+		}
+		k_spin_unlock(&jitter_lock, key);
+
+		if ((frames_played % STATS_LOG_INTERVAL_FRAMES) == 0U) {
+			struct sink_stats snapshot;
+
+			sink_stats_get(&snapshot);
+			LOG_INF("Received %u, lost %u, late %u, resyncs %u", snapshot.received,
+				snapshot.lost, snapshot.late, snapshot.resyncs);
+		}
+	}
+
+	key = k_spin_lock(&jitter_lock);
+	playing = false;
+	k_spin_unlock(&jitter_lock, key);
+
+	/* Also frees the blocks queued to the driver */
+	(void)i2s_trigger(i2s_dev, I2S_DIR_TX, I2S_TRIGGER_DROP);
+	LOG_INF("Playback stopped");
+
+	return err;
+}
+
+static void decoder_thread(void *arg1, void *arg2, void *arg3)
+{
+	while (true) {
+		k_sem_take(&playback_sem, K_FOREVER);
+
+		/* Streaming goes on without anyone playing it, start over from a fresh BIG
+		 * sync, which gives playback_sem again once all streams have started.
+		 */
+		if (playback_run() != 0 && atomic_get(&streaming)) {
+			sink_flag_raise(SINK_FLAG_RESET);
+		}
+	}
+}
+
+K_THREAD_DEFINE(sink_decoder, DECODER_STACK_SIZE, decoder_thread, NULL, NULL, NULL,
+		DECODER_PRIORITY, 0, 0);
+
+void sink_stats_get(struct sink_stats *snapshot)
+{
+	k_spinlock_key_t key = k_spin_lock(&jitter_lock);
+
+	*snapshot = stats;
+	k_spin_unlock(&jitter_lock, key);
+}
+
+void sink_kick(void)
+{
+	k_work_submit(&sink_work);
+}
+
+int sink_init(void)
+{
+	int err;
+
+	if (!device_is_ready(i2s_dev)) {
+		LOG_ERR("I2S device %s is not ready", i2s_dev->name);
+		return -ENODEV;
+	}
+
+	err = bt_bap_broadcast_sink_register_cb(&broadcast_sink_cb);
+	if (err != 0) {
+		LOG_ERR("Unable to register broadcast sink callbacks: %d", err);
+		return err;
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		bt_bap_stream_cb_register(&streams[i].stream, &stream_ops);
+	}
+
+	bt_le_per_adv_sync_cb_register(&pa_sync_cb);
+	sink_kick();
+
+	return 0;
+}
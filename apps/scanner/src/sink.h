@@ -0,0 +1,42 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <stdint.h>
+
+/** Receive counters of the sink, accumulated over all played streams */
+struct sink_stats {
+	/** SDUs received in time */
+	uint32_t received;
+	/** Frames not received in time, or flagged invalid, and concealed */
+	uint32_t lost;
+	/** SDUs received after their frames had been played, and dropped */
+	uint32_t late;
+	/** Times the jitter buffer overflowed and playback skipped ahead */
+	uint32_t resyncs;
+};
+
+/**
+ * Set up the I2S output and the broadcast sink.
+ *
+ * The sink plays the source of the source table with the strongest RSSI whose BASE has
+ * an LC3 subgroup it supports and that is not encrypted.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int sink_init(void);
+
+/** Look for a source to play if the sink is idle, e.g. after a BASE was read */
+void sink_kick(void);
+
+/**
+ * Get a snapshot of the receive counters.
+ *
+ * @param[out] stats Counters
+ */
+void sink_stats_get(struct sink_stats *stats);
+
+#endif /* SINK_H_ */
@@ -0,0 +1,327 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/audio/audio.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(source_table, LOG_LEVEL_INF);
+
+#include "source_table.h"
+
+/* Weight of a new report in the RSSI average, as a right shift */
+#define RSSI_AVG_SHIFT 3
+/* The RSSI average is kept in 1/16 dBm */
+#define RSSI_AVG_ONE 16
+
+#define AGE_CHECK_INTERVAL_MS MAX(CONFIG_SCANNER_SOURCE_TIMEOUT_MS / 4, 250)
+
+struct source_table_slot {
+	struct source_table_entry entry;
+	bool used;
+	/* Hash of the AD of the last report, to skip parsing reports that did not change */
+	uint32_t ad_hash;
+	/* RSSI average in units of 1 / RSSI_AVG_ONE dBm */
+	int16_t rssi_avg;
+	/* Uptime the source was last picked by source_table_base_claim(), 0 if never */
+	int64_t base_claim_ms;
+	/* base_claim_ms before that pick, restored by source_table_base_unclaim() */
+	int64_t base_claim_prev_ms;
+};
+
+struct source_table_ad {
+	bool has_broadcast_id;
+	uint32_t broadcast_id;
+	char broadcast_name[BT_AUDIO_BROADCAST_NAME_LEN_MAX + 1];
+};
+
+static struct source_table_slot slots[CONFIG_SCANNER_SOURCE_TABLE_SIZE];
+/* Recursive, so that the event callback can call back into the table */
+static K_MUTEX_DEFINE(table_lock);
+static source_table_cb_t table_cb;
+
+static void age_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(age_work, age_handler);
+
+/* FNV-1a, much cheaper than parsing the AD and comparing all of its fields */
+static uint32_t ad_hash_get(const struct net_buf_simple *ad)
+{
+	uint32_t hash = 2166136261U;
+
+	for (uint16_t i = 0U; i < ad->len; i++) {
+		hash ^= ad->data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static bool broadcast_source_found(struct bt_data *data, void *user_data)
+{
+	struct source_table_ad *parsed = user_data;
+	struct bt_uuid_16 adv_uuid;
+
+	switch (data->type) {
+	case BT_DATA_SVC_DATA16:
+		if (data->data_len < BT_UUID_SIZE_16 + BT_AUDIO_BROADCAST_ID_SIZE) {
+			return true;
+		}
+
+		if (!bt_uuid_create(&adv_uuid.uuid, data->data, BT_UUID_SIZE_16)) {
+			return true;
+		}
+
+		if (bt_uuid_cmp(&adv_uuid.uuid, BT_UUID_BROADCAST_AUDIO) != 0) {
+			return true;
+		}
+
+		parsed->broadcast_id = sys_get_le24(data->data + BT_UUID_SIZE_16);
+		parsed->has_broadcast_id = true;
+		break;
+	case BT_DATA_BROADCAST_NAME:
+		if (!IN_RANGE(data->data_len, BT_AUDIO_BROADCAST_NAME_LEN_MIN,
+		    BT_AUDIO_BROADCAST_NAME_LEN_MAX)) {
+			return true;
+		}
+
+		utf8_lcpy(parsed->broadcast_name, data->data, (data->data_len) + 1);
+		break;
+	default:
+		return true;
+	}
+
+	/* Stop parsing as soon as everything the table needs has been found */
+	return !parsed->has_broadcast_id || parsed->broadcast_name[0] == '\0';
+}
+
+static struct source_table_slot *slot_find_adv(const bt_addr_le_t *addr, uint8_t sid)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].used && slots[i].entry.sid == sid &&
+		    bt_addr_le_eq(&slots[i].entry.addr, addr)) {
+			return &slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct source_table_slot *slot_find_id(uint32_t broadcast_id)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].used && slots[i].entry.broadcast_id == broadcast_id) {
+			return &slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct source_table_slot *slot_alloc(void)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].used) {
+			slots[i].used = true;
+			return &slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void rssi_update(struct source_table_slot *slot, int8_t rssi)
+{
+	if (rssi == BT_GAP_RSSI_INVALID) {
+		return;
+	}
+
+	slot->rssi_avg += (rssi * RSSI_AVG_ONE - slot->rssi_avg) >> RSSI_AVG_SHIFT;
+	slot->entry.rssi = slot->rssi_avg / RSSI_AVG_ONE;
+}
+
+static void event_notify(enum source_table_event event, const struct source_table_slot *slot)
+{
+	if (table_cb != NULL) {
+		table_cb(event, &slot->entry);
+	}
+}
+
+void source_table_report(const bt_addr_le_t *addr, uint8_t sid, int8_t rssi, uint16_t interval,
+			 struct net_buf_simple *ad)
+{
+	const uint32_t hash = ad_hash_get(ad);
+	struct source_table_ad parsed = {0};
+	struct source_table_slot *slot;
+	bool changed = false;
+	bool added = false;
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	slot = slot_find_adv(addr, sid);
+	if (slot != NULL && slot->ad_hash == hash) {
+		/* Same advertising set with the same AD: nothing to parse or to report */
+		rssi_update(slot, rssi);
+		slot->entry.last_seen_ms = k_uptime_get();
+		k_mutex_unlock(&table_lock);
+		return;
+	}
+	k_mutex_unlock(&table_lock);
+
+	bt_data_parse(ad, broadcast_source_found, &parsed);
+	if (!parsed.has_broadcast_id) {
+		return;
+	}
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	/* Matched again by broadcast ID, which survives address changes of the advertiser */
+	slot = slot_find_id(parsed.broadcast_id);
+	if (slot == NULL) {
+		slot = slot_alloc();
+		if (slot == NULL) {
+			k_mutex_unlock(&table_lock);
+			LOG_DBG("Table full, ignoring broadcast 0x%06x", parsed.broadcast_id);
+			return;
+		}
+
+		slot->entry.broadcast_id = parsed.broadcast_id;
+		slot->rssi_avg = rssi * RSSI_AVG_ONE;
+		slot->entry.rssi = rssi;
+		added = true;
+	} else {
+		changed = strcmp(slot->entry.broadcast_name, parsed.broadcast_name) != 0 ||
+			  !bt_addr_le_eq(&slot->entry.addr, addr) || slot->entry.sid != sid ||
+			  slot->entry.interval != interval;
+		rssi_update(slot, rssi);
+	}
+
+	(void)strcpy(slot->entry.broadcast_name, parsed.broadcast_name);
+	bt_addr_le_copy(&slot->entry.addr, addr);
+	slot->entry.sid = sid;
+	slot->entry.interval = interval;
+	slot->entry.last_seen_ms = k_uptime_get();
+	slot->ad_hash = hash;
+
+	if (added) {
+		event_notify(SOURCE_TABLE_ADDED, slot);
+	} else if (changed) {
+		event_notify(SOURCE_TABLE_CHANGED, slot);
+	}
+	k_mutex_unlock(&table_lock);
+}
+
+bool source_table_base_claim(struct source_table_entry *entry, bool (*busy)(uint32_t broadcast_id),
+			     uint32_t retry_ms)
+{
+	const int64_t now = k_uptime_get();
+	struct source_table_slot *claimed = NULL;
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		struct source_table_slot *slot = &slots[i];
+
+		if (!slot->used || slot->entry.base.valid ||
+		    (slot->base_claim_ms != 0 && now - slot->base_claim_ms < retry_ms) ||
+		    (busy != NULL && busy(slot->entry.broadcast_id))) {
+			continue;
+		}
+
+		if (claimed == NULL || slot->base_claim_ms < claimed->base_claim_ms) {
+			claimed = slot;
+		}
+	}
+
+	if (claimed != NULL) {
+		claimed->base_claim_prev_ms = claimed->base_claim_ms;
+		claimed->base_claim_ms = now;
+		*entry = claimed->entry;
+	}
+	k_mutex_unlock(&table_lock);
+
+	return claimed != NULL;
+}
+
+void source_table_base_unclaim(uint32_t broadcast_id)
+{
+	struct source_table_slot *slot;
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	slot = slot_find_id(broadcast_id);
+	if (slot != NULL) {
+		slot->base_claim_ms = slot->base_claim_prev_ms;
+	}
+	k_mutex_unlock(&table_lock);
+}
+
+int source_table_base_set(uint32_t broadcast_id, const struct source_table_base *base)
+{
+	struct source_table_slot *slot;
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	slot = slot_find_id(broadcast_id);
+	if (slot == NULL) {
+		k_mutex_unlock(&table_lock);
+		return -ENOENT;
+	}
+
+	slot->entry.base = *base;
+	event_notify(SOURCE_TABLE_BASE_UPDATED, slot);
+	k_mutex_unlock(&table_lock);
+
+	return 0;
+}
+
+bool source_table_best(struct source_table_entry *entry,
+		       bool (*filter)(const struct source_table_entry *entry))
+{
+	const struct source_table_slot *best = NULL;
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].used || (filter != NULL && !filter(&slots[i].entry))) {
+			continue;
+		}
+
+		if (best == NULL || slots[i].rssi_avg > best->rssi_avg) {
+			best = &slots[i];
+		}
+	}
+
+	if (best != NULL) {
+		*entry = best->entry;
+	}
+	k_mutex_unlock(&table_lock);
+
+	return best != NULL;
+}
+
+static void age_handler(struct k_work *work)
+{
+	const int64_t now = k_uptime_get();
+
+	k_mutex_lock(&table_lock, K_FOREVER);
+	for (size_t i = 0U; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].used &&
+		    now - slots[i].entry.last_seen_ms > CONFIG_SCANNER_SOURCE_TIMEOUT_MS) {
+			event_notify(SOURCE_TABLE_REMOVED, &slots[i]);
+			(void)memset(&slots[i], 0, sizeof(slots[i]));
+		}
+	}
+	k_mutex_unlock(&table_lock);
+
+	(void)k_work_reschedule(k_work_delayable_from_work(work), K_MSEC(AGE_CHECK_INTERVAL_MS));
+}
+
+void source_table_init(source_table_cb_t cb)
+{
+	table_cb = cb;
+	(void)k_work_reschedule(&age_work, K_MSEC(AGE_CHECK_INTERVAL_MS));
+}
@@ -0,0 +1,144 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SOURCE_TABLE_H_
+#define SOURCE_TABLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/bluetooth/audio/audio.h>
+#include <zephyr/net_buf.h>
+
+/** LC3 configuration of a subgroup, as read from the BASE */
+struct source_table_subgroup {
+	uint32_t freq_hz;
+	uint32_t frame_duration_us;
+	uint16_t octets_per_frame;
+	/** Codec frames sent per channel in each SDU */
+	uint8_t frame_blocks_per_sdu;
+	/** BIS indexes of the subgroup, bit n - 1 standing for BIS index n */
+	uint32_t bis_index_bitfield;
+};
+
+/** Stream capabilities of a source, read from its periodic advertising */
+struct source_table_base {
+	/** The BASE of the source has been read */
+	bool valid;
+	/** A BIGInfo was received along with the BASE */
+	bool has_biginfo;
+	bool encrypted;
+	uint8_t num_bis;
+	uint32_t presentation_delay_us;
+	uint8_t subgroup_count;
+	struct source_table_subgroup subgroups[CONFIG_SCANNER_BASE_MAX_SUBGROUPS];
+};
+
+/** A broadcast source seen by the scanner */
+struct source_table_entry {
+	uint32_t broadcast_id;
+	char broadcast_name[BT_AUDIO_BROADCAST_NAME_LEN_MAX + 1];
+	bt_addr_le_t addr;
+	uint8_t sid;
+	/** Periodic advertising interval, in units of 1.25 ms */
+	uint16_t interval;
+	/** RSSI averaged over the received reports, in dBm */
+	int8_t rssi;
+	/** Uptime of the last report, in milliseconds */
+	int64_t last_seen_ms;
+	struct source_table_base base;
+};
+
+enum source_table_event {
+	/** A broadcast source was seen for the first time */
+	SOURCE_TABLE_ADDED,
+	/** The name, address, SID or interval of a known source changed */
+	SOURCE_TABLE_CHANGED,
+	/** A source was not seen for CONFIG_SCANNER_SOURCE_TIMEOUT_MS */
+	SOURCE_TABLE_REMOVED,
+	/** The BASE of a source was read */
+	SOURCE_TABLE_BASE_UPDATED,
+};
+
+/**
+ * Called on changes of the table, from the context of source_table_report() or of the
+ * system workqueue for removals. The table is locked during the call, but may be queried
+ * from the callback.
+ *
+ * @param event What happened to the source
+ * @param entry Snapshot of the source after the event
+ */
+typedef void (*source_table_cb_t)(enum source_table_event event,
+				  const struct source_table_entry *entry);
+
+/**
+ * Start the table and the ageing of its entries.
+ *
+ * @param cb Callback for table events
+ */
+void source_table_init(source_table_cb_t cb);
+
+/**
+ * Feed an extended advertising report into the table.
+ *
+ * The AD of the report is only parsed if it differs from the last report of the same
+ * advertising set, otherwise only the RSSI and last seen time of the source are updated.
+ *
+ * @param addr Address of the advertiser
+ * @param sid Advertising set ID
+ * @param rssi RSSI of the report
+ * @param interval Periodic advertising interval
+ * @param ad Advertising data of the report
+ */
+void source_table_report(const bt_addr_le_t *addr, uint8_t sid, int8_t rssi, uint16_t interval,
+			 struct net_buf_simple *ad);
+
+/**
+ * Pick a source whose BASE is still to be read.
+ *
+ * Sources are picked in the order they were last picked, and are not picked again
+ * within @p retry_ms, so that a source that cannot be synced to does not starve the
+ * others.
+ *
+ * @param[out] entry Snapshot of the source
+ * @param busy Returns true for broadcast IDs that shall not be picked, may be NULL
+ * @param retry_ms Minimum time between two picks of the same source
+ *
+ * @return true if a source was picked.
+ */
+bool source_table_base_claim(struct source_table_entry *entry, bool (*busy)(uint32_t broadcast_id),
+			     uint32_t retry_ms);
+
+/**
+ * Undo the last source_table_base_claim() of a source, e.g. when syncing to it could not
+ * be started, so that it may be picked again right away.
+ *
+ * @param broadcast_id Broadcast ID of the source
+ */
+void source_table_base_unclaim(uint32_t broadcast_id);
+
+/**
+ * Store the BASE read for a source.
+ *
+ * @param broadcast_id Broadcast ID of the source
+ * @param base Stream capabilities of the source
+ *
+ * @return 0 on success, -ENOENT if the source is no longer in the table.
+ */
+int source_table_base_set(uint32_t broadcast_id, const struct source_table_base *base);
+
+/**
+ * Get the source with the strongest averaged RSSI.
+ *
+ * @param[out] entry Snapshot of the source
+ * @param filter Returns true for the sources to consider, may be NULL for all of them.
+ *		 Called with the table locked.
+ *
+ * @return true if a source was found.
+ */
+bool source_table_best(struct source_table_entry *entry,
+		       bool (*filter)(const struct source_table_entry *entry));
+
+#endif /* SOURCE_TABLE_H_ */
@@ -0,0 +1,163 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+#include <zephyr/toolchain.h>
+
+#if defined(CONFIG_CPU_CORTEX_M) && defined(__ARM_FEATURE_DSP)
+#include <cmsis_core.h>
+#define DECIMATOR_USE_SIMD 1
+#endif
+
+#include "decimator.h"
+
+/* Kaiser windowed sinc (beta 6) low-pass filters in Q15 with unity DC gain. The cut-off
+ * sits just below the output Nyquist frequency. Anything that folds back below the
+ * -3 dB point is at least 60 dB down, while the transition band above the output
+ * Nyquist frequency, which folds back between the -3 dB point and the output Nyquist
+ * frequency, is attenuated less. The figures of each filter are given with it.
+ *
+ * Both filters are symmetric and have an even number of taps, so they can be
+ * evaluated two taps at a time.
+ */
+
+/* 48 kHz -> 24 kHz: -3 dB at 10.1 kHz, -46 dB at 13.5 kHz, -60 dB from 13.75 kHz */
+static const int16_t __aligned(4) taps_ratio_2[] = {
+	1,     26,    13,    -88,   -81,   182,   269,   -264,  -652,  227,   1325,
+	144,   -2516, -1486, 5777,  13507, 13507, 5777,  -1486, -2516, 144,   1325,
+	227,   -652,  -264,  269,   182,   -81,   -88,   13,    26,    1,
+};
+
+/* 48 kHz -> 16 kHz: -3 dB at 6.8 kHz, -48 dB at 9 kHz, -62 dB from 9.25 kHz */
+static const int16_t __aligned(4) taps_ratio_3[] = {
+	-1,    9,     22,    16,    -23,   -72,   -71,   21,    157,   203,   45,    -257,
+	-447,  -254,  313,   838,   739,   -203,  -1451, -1866, -438,  2859,  6790,  9455,
+	9455,  6790,  2859,  -438,  -1866, -1451, -203,  739,   838,   313,   -254,  -447,
+	-257,  45,    203,   157,   21,    -71,   -72,   -23,   16,    22,    9,     -1,
+};
+
+BUILD_ASSERT(ARRAY_SIZE(taps_ratio_2) <= DECIMATOR_MAX_TAPS && ARRAY_SIZE(taps_ratio_2) % 2 == 0);
+BUILD_ASSERT(ARRAY_SIZE(taps_ratio_3) <= DECIMATOR_MAX_TAPS && ARRAY_SIZE(taps_ratio_3) % 2 == 0);
+
+#if defined(DECIMATOR_USE_SIMD)
+static inline uint32_t read_q15x2(const int16_t *p)
+{
+	uint32_t val;
+
+	/* Windows and channels start at any sample, so the pair may not be word aligned */
+	memcpy(&val, p, sizeof(val));
+
+	return val;
+}
+#endif /* defined(DECIMATOR_USE_SIMD) */
+
+static inline int16_t fir_q15(const int16_t *x, const int16_t *h, size_t num_taps)
+{
+	/* The sum of the absolute tap values stays below 2^16, so the accumulator cannot
+	 * overflow.
+	 */
+	int32_t acc = BIT(14);
+
+#if defined(DECIMATOR_USE_SIMD)
+	for (size_t k = 0U; k < num_taps; k += 2U) {
+		acc = (int32_t)__SMLAD(read_q15x2(&x[k]), read_q15x2(&h[k]), (uint32_t)acc);
+	}
+
+	return (int16_t)__SSAT(acc >> 15, 16);
+#else
+	for (size_t k = 0U; k < num_taps; k++) {
+		acc += (int32_t)x[k] * h[k];
+	}
+
+	return (int16_t)CLAMP(acc >> 15, INT16_MIN, INT16_MAX);
+#endif /* defined(DECIMATOR_USE_SIMD) */
+}
+
+/* Gather one channel out of interleaved PCM data */
+static void deinterleave(const int16_t *in, size_t stride, size_t num, int16_t *out)
+{
+	size_t i = 0U;
+
+#if defined(DECIMATOR_USE_SIMD)
+	if (stride == 2U) {
+		/* Two output samples per pair of word loads. The second load reaches one
+		 * sample past the last one read, so the last two samples are left to the
+		 * scalar loop to stay within the input.
+		 */
+		for (; i + 3U <= num; i += 2U) {
+			const uint32_t pair = __PKHBT(read_q15x2(&in[2U * i]),
+						      read_q15x2(&in[2U * i + 2U]), 16);
+
+			memcpy(&out[i], &pair, sizeof(pair));
+		}
+	}
+#endif /* defined(DECIMATOR_USE_SIMD) */
+
+	for (; i < num; i++) {
+		out[i] = in[i * stride];
+	}
+}
+
+int decimator_init(struct decimator *dec, unsigned int ratio)
+{
+	switch (ratio) {
+	case 1:
+		dec->taps = NULL;
+		dec->num_taps = 0U;
+		break;
+	case 2:
+		dec->taps = taps_ratio_2;
+		dec->num_taps = ARRAY_SIZE(taps_ratio_2);
+		break;
+	case 3:
+		dec->taps = taps_ratio_3;
+		dec->num_taps = ARRAY_SIZE(taps_ratio_3);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	dec->ratio = ratio;
+
+	/* Start from silence, so the first output only needs a single block of input */
+	dec->len = dec->num_taps > 0U ? dec->num_taps - 1U : 0U;
+	(void)memset(dec->history, 0, sizeof(dec->history));
+
+	return 0;
+}
+
+size_t decimator_process(struct decimator *dec, const int16_t *in, size_t stride, size_t num_in,
+			 int16_t *out)
+{
+	size_t num_out = 0U;
+	size_t pos = 0U;
+
+	num_in = MIN(num_in, DECIMATOR_MAX_INPUT_SAMPLES);
+
+	if (dec->num_taps == 0U) {
+		deinterleave(in, stride, num_in, out);
+
+		return num_in;
+	}
+
+	deinterleave(in, stride, num_in, &dec->history[dec->len]);
+	dec->len += num_in;
+
+	/* Only every ratio-th output of the filter is kept, so only those are computed */
+	while (pos + dec->num_taps <= dec->len) {
+		out[num_out++] = fir_q15(&dec->history[pos], dec->taps, dec->num_taps);
+		pos += dec->ratio;
+	}
+
+	/* Keep the samples the next windows still overlap */
+	dec->len -= pos;
+	memmove(dec->history, &dec->history[pos], dec->len * sizeof(dec->history[0]));
+
+	return num_out;
+}
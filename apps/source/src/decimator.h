@@ -0,0 +1,63 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DECIMATOR_H_
+#define DECIMATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest input block per channel accepted by decimator_process(), i.e. one 1 ms USB
+ * frame at 48 kHz plus the extra sample an asynchronous endpoint may be sent.
+ */
+#define DECIMATOR_MAX_INPUT_SAMPLES 49
+#define DECIMATOR_MAX_TAPS          48
+#define DECIMATOR_MAX_RATIO         3
+
+/* Number of output samples decimator_process() can produce for a block of
+ * @p num_in input samples.
+ */
+#define DECIMATOR_MAX_OUTPUT_SAMPLES(num_in, ratio) (((num_in) / (ratio)) + 1)
+
+struct decimator {
+	const int16_t *taps;
+	size_t num_taps;
+	unsigned int ratio;
+	/* Number of valid samples in history */
+	size_t len;
+	/* Input samples not yet consumed by the filter, oldest first */
+	int16_t history[DECIMATOR_MAX_TAPS + DECIMATOR_MAX_RATIO + DECIMATOR_MAX_INPUT_SAMPLES];
+};
+
+/**
+ * Set up a fixed-point low-pass FIR decimator.
+ *
+ * @param dec Decimator instance
+ * @param ratio Decimation ratio: 1 (pass-through), 2 (48 -> 24 kHz) or 3 (48 -> 16 kHz)
+ *
+ * @return 0 on success, -EINVAL if the ratio is not supported.
+ */
+int decimator_init(struct decimator *dec, unsigned int ratio);
+
+/**
+ * Filter and decimate one block of a single channel.
+ *
+ * Reads @p num_in samples spaced @p stride samples apart, so one channel can be
+ * taken directly out of interleaved PCM data. The filter state carries over between
+ * calls, so blocks need not be multiples of the ratio. Stereo input (@p stride 2) is
+ * deinterleaved two samples at a time where the CPU has the DSP extension.
+ *
+ * @param dec Decimator instance
+ * @param in First input sample of the channel
+ * @param stride Distance between consecutive input samples, in samples
+ * @param num_in Number of input samples, at most DECIMATOR_MAX_INPUT_SAMPLES
+ * @param out Destination, room for DECIMATOR_MAX_OUTPUT_SAMPLES(num_in, ratio) samples,
+ *	      need not be word aligned
+ *
+ * @return Number of samples written to @p out.
+ */
+size_t decimator_process(struct decimator *dec, const int16_t *in, size_t stride, size_t num_in,
+			 int16_t *out);
+
+#endif /* DECIMATOR_H_ */
@@ -22,528 +22,2224 @@
 #include <zephyr/devicetree.h>
 #include <zephyr/kernel.h>
 #include <zephyr/net_buf.h>
-#include <zephyr/sys/printk.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/sys_clock.h>
 #include <zephyr/toolchain.h>
 
-BUILD_ASSERT(strlen(CONFIG_BROADCAST_CODE) <= BT_ISO_BROADCAST_CODE_SIZE, "Invalid broadcast code");
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app, LOG_LEVEL_INF);
 
-/* Zephyr Controller works best while Extended Advertising interval to be a multiple
- * of the ISO Interval minus 10 ms (max. advertising random delay). This is
- * required to place the AUX_ADV_IND PDUs in a non-overlapping interval with the
- * Broadcast ISO radio events.
- *
- * I.e. for a 7.5 ms ISO interval use 90 ms minus 10 ms ==> 80 ms advertising
- * interval.
- * And, for 10 ms ISO interval, can use 90 ms minus 10 ms ==> 80 ms advertising
- * interval.
+/* Messages from the encoder and USB paths are rate limited per call site, so that an
+ * error storm cannot flood the log right when the pipeline is already behind.
  */
-#define BT_LE_EXT_ADV_CUSTOM BT_LE_ADV_PARAM(BT_LE_ADV_OPT_EXT_ADV, 0x0080, 0x0080, NULL)
+#define LOG_RATELIMIT_INTERVAL_MS 1000
+
+#define LOG_RATELIMIT(_log, ...)                                                                   \
+	do {                                                                                       \
+		static int64_t last_ms = -LOG_RATELIMIT_INTERVAL_MS;                               \
+		const int64_t now_ms = k_uptime_get();                                             \
+                                                                                                   \
+		if (now_ms - last_ms >= LOG_RATELIMIT_INTERVAL_MS) {                               \
+			last_ms = now_ms;                                                          \
+			_log(__VA_ARGS__);                                                         \
+		}                                                                                  \
+	} while (0)
+
+BUILD_ASSERT(strlen(CONFIG_BROADCAST_CODE) <= BT_ISO_BROADCAST_CODE_SIZE, "Invalid broadcast code");
 
 /* When BROADCAST_ENQUEUE_COUNT > 1 we can enqueue enough buffers to ensure that
- * the controller is never idle
+ * the controller is never idle, at the cost of one SDU interval of latency each.
  */
-#define BROADCAST_ENQUEUE_COUNT 3U
+#define BROADCAST_ENQUEUE_COUNT CONFIG_BROADCAST_ENQUEUE_COUNT
 #define TOTAL_BUF_NEEDED        (BROADCAST_ENQUEUE_COUNT * CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT)
 
 BUILD_ASSERT(CONFIG_BT_ISO_TX_BUF_COUNT >= TOTAL_BUF_NEEDED,
 	     "CONFIG_BT_ISO_TX_BUF_COUNT should be at least "
 	     "BROADCAST_ENQUEUE_COUNT * CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT");
 
-#if defined(CONFIG_BAP_BROADCAST_16_2_1)
+#define BROADCAST_LOCATION (BT_AUDIO_LOCATION_FRONT_LEFT | BT_AUDIO_LOCATION_FRONT_RIGHT)
 
-static struct bt_bap_lc3_preset preset_active = BT_BAP_LC3_BROADCAST_PRESET_16_2_1(
-	BT_AUDIO_LOCATION_FRONT_LEFT | BT_AUDIO_LOCATION_FRONT_RIGHT,
-	BT_AUDIO_CONTEXT_TYPE_UNSPECIFIED);
+/* The codec configuration follows the BAP broadcast presets, while retransmissions,
+ * transport latency and presentation delay come from Kconfig.
+ */
+#define BROADCAST_FRAME_BLOCKS_PER_SDU CONFIG_BROADCAST_FRAME_BLOCKS_PER_SDU
+
+#define BROADCAST_PRESET(_freq, _dur, _dur_us, _octets)                                           \
+	BT_BAP_LC3_PRESET(BT_AUDIO_CODEC_LC3_CONFIG(_freq, _dur, BROADCAST_LOCATION, _octets,      \
+						    BROADCAST_FRAME_BLOCKS_PER_SDU,                \
+						    BT_AUDIO_CONTEXT_TYPE_UNSPECIFIED),            \
+			  BT_BAP_QOS_CFG_UNFRAMED((_dur_us) * BROADCAST_FRAME_BLOCKS_PER_SDU,      \
+						  (_octets) * BROADCAST_FRAME_BLOCKS_PER_SDU,      \
+						  CONFIG_BROADCAST_RTN,                            \
+						  CONFIG_BROADCAST_MAX_TRANSPORT_LATENCY_MS,       \
+						  CONFIG_BROADCAST_PRESENTATION_DELAY_US))
+
+#define BROADCAST_PRESET_16_1_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_16KHZ, BT_AUDIO_CODEC_CFG_DURATION_7_5, 7500u, 30U)
+#define BROADCAST_PRESET_24_1_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_24KHZ, BT_AUDIO_CODEC_CFG_DURATION_7_5, 7500u, 45U)
+#define BROADCAST_PRESET_48_1_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_48KHZ, BT_AUDIO_CODEC_CFG_DURATION_7_5, 7500u, 75U)
+#define BROADCAST_PRESET_16_2_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_16KHZ, BT_AUDIO_CODEC_CFG_DURATION_10, 10000u, 40U)
+#define BROADCAST_PRESET_24_2_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_24KHZ, BT_AUDIO_CODEC_CFG_DURATION_10, 10000u, 60U)
+#define BROADCAST_PRESET_48_2_1                                                                    \
+	BROADCAST_PRESET(BT_AUDIO_CODEC_CFG_FREQ_48KHZ, BT_AUDIO_CODEC_CFG_DURATION_10, 10000u, 100U)
+
+#if defined(CONFIG_BROADCAST_PACKING_INTERLEAVED)
+#define BROADCAST_PACKING BT_ISO_PACKING_INTERLEAVED
+#else
+#define BROADCAST_PACKING BT_ISO_PACKING_SEQUENTIAL
+#endif /* defined(CONFIG_BROADCAST_PACKING_INTERLEAVED) */
 
-static uint8_t left_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_16KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_LEFT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(40U)),
-};
+/* The primary preset is used by the first subgroup and configures the BIG */
+#if defined(CONFIG_BAP_BROADCAST_16_1_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_16_1_1;
+#define BROADCAST_SAMPLE_RATE 16000
+#define BROADCAST_OCTETS_PER_FRAME 30
+#define BROADCAST_FRAME_DURATION_US 7500
+#elif defined(CONFIG_BAP_BROADCAST_24_1_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_24_1_1;
+#define BROADCAST_SAMPLE_RATE 24000
+#define BROADCAST_OCTETS_PER_FRAME 45
+#define BROADCAST_FRAME_DURATION_US 7500
+#elif defined(CONFIG_BAP_BROADCAST_48_1_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_48_1_1;
+#define BROADCAST_SAMPLE_RATE 48000
+#define BROADCAST_OCTETS_PER_FRAME 75
+#define BROADCAST_FRAME_DURATION_US 7500
+#elif defined(CONFIG_BAP_BROADCAST_16_2_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_16_2_1;
+#define BROADCAST_SAMPLE_RATE 16000
+#define BROADCAST_OCTETS_PER_FRAME 40
+#define BROADCAST_FRAME_DURATION_US 10000
+#elif defined(CONFIG_BAP_BROADCAST_24_2_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_24_2_1;
+#define BROADCAST_SAMPLE_RATE 24000
+#define BROADCAST_OCTETS_PER_FRAME 60
+#define BROADCAST_FRAME_DURATION_US 10000
+#elif defined(CONFIG_BAP_BROADCAST_48_2_1)
+static struct bt_bap_lc3_preset preset_active = BROADCAST_PRESET_48_2_1;
+#define BROADCAST_SAMPLE_RATE 48000
+#define BROADCAST_OCTETS_PER_FRAME 100
+#define BROADCAST_FRAME_DURATION_US 10000
+#endif
 
-static uint8_t right_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_16KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_RIGHT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(40U)),
-};
+#define BROADCAST_ISO_INTERVAL_US (BROADCAST_FRAME_DURATION_US * BROADCAST_FRAME_BLOCKS_PER_SDU)
 
-#define BROADCAST_SAMPLE_RATE 16000
+/* Zephyr Controller works best while Extended Advertising interval to be a multiple
+ * of the ISO Interval minus 10 ms (max. advertising random delay). This is
+ * required to place the AUX_ADV_IND PDUs in a non-overlapping interval with the
+ * Broadcast ISO radio events.
+ *
+ * I.e. for a 7.5 ms or a 10 ms ISO interval use 90 ms minus 10 ms ==> 80 ms advertising
+ * interval, and for a 20 ms ISO interval 100 ms minus 10 ms ==> 90 ms.
+ */
+#define ADV_INTERVAL_MIN_US     90000
+#define ADV_RANDOM_DELAY_MAX_US 10000
+#define ADV_INTERVAL_US                                                                            \
+	(ROUND_UP(ADV_INTERVAL_MIN_US, BROADCAST_ISO_INTERVAL_US) - ADV_RANDOM_DELAY_MAX_US)
+/* Advertising intervals are in units of 0.625 ms */
+#define ADV_INTERVAL (ADV_INTERVAL_US / 625)
+
+BUILD_ASSERT(ADV_INTERVAL_US % 625 == 0,
+	     "Advertising interval is not a multiple of the 0.625 ms advertising unit");
+
+#define BT_LE_EXT_ADV_CUSTOM                                                                       \
+	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_EXT_ADV, ADV_INTERVAL, ADV_INTERVAL, NULL)
+
+#if defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP)
+/* The secondary preset is used by all other subgroups. Kconfig only offers presets with
+ * a lower sample rate and bitrate than the primary one, so that the BIG's SDU size and
+ * the PCM buffers sized for the primary preset hold the secondary frames as well.
+ */
+#if defined(CONFIG_BROADCAST_SECONDARY_16_1_1)
+static struct bt_bap_lc3_preset preset_secondary = BROADCAST_PRESET_16_1_1;
+#define SECONDARY_SAMPLE_RATE 16000
+#define SECONDARY_FRAME_DURATION_US 7500
+#elif defined(CONFIG_BROADCAST_SECONDARY_24_1_1)
+static struct bt_bap_lc3_preset preset_secondary = BROADCAST_PRESET_24_1_1;
+#define SECONDARY_SAMPLE_RATE 24000
+#define SECONDARY_FRAME_DURATION_US 7500
+#elif defined(CONFIG_BROADCAST_SECONDARY_16_2_1)
+static struct bt_bap_lc3_preset preset_secondary = BROADCAST_PRESET_16_2_1;
+#define SECONDARY_SAMPLE_RATE 16000
+#define SECONDARY_FRAME_DURATION_US 10000
+#elif defined(CONFIG_BROADCAST_SECONDARY_24_2_1)
+static struct bt_bap_lc3_preset preset_secondary = BROADCAST_PRESET_24_2_1;
+#define SECONDARY_SAMPLE_RATE 24000
+#define SECONDARY_FRAME_DURATION_US 10000
+#endif
 
-#elif defined(CONFIG_BAP_BROADCAST_24_2_1)
+/* All BISes of a BIG share the same ISO interval */
+BUILD_ASSERT(SECONDARY_FRAME_DURATION_US == BROADCAST_FRAME_DURATION_US,
+	     "Secondary preset shall use the frame duration of the primary preset");
 
-static struct bt_bap_lc3_preset preset_active = BT_BAP_LC3_BROADCAST_PRESET_24_2_1(
-	BT_AUDIO_LOCATION_FRONT_LEFT | BT_AUDIO_LOCATION_FRONT_RIGHT,
-	BT_AUDIO_CONTEXT_TYPE_UNSPECIFIED);
+BUILD_ASSERT(CONFIG_BT_BAP_BROADCAST_SRC_SUBGROUP_COUNT > 1,
+	     "CONFIG_BROADCAST_SECONDARY_SUBGROUP needs more than one subgroup");
 
-static uint8_t left_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_24KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_LEFT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(60U)),
+#define BROADCAST_PRESET_COUNT 2
+#else
+#define BROADCAST_PRESET_COUNT 1
+#endif /* defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP) */
+
+static struct bt_bap_lc3_preset *const broadcast_presets[BROADCAST_PRESET_COUNT] = {
+	&preset_active,
+#if defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP)
+	&preset_secondary,
+#endif /* defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP) */
 };
 
-static uint8_t right_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_24KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_RIGHT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(60U)),
-};
+#define STREAMS_PER_SUBGROUP                                                                       \
+	(CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT / CONFIG_BT_BAP_BROADCAST_SRC_SUBGROUP_COUNT)
 
-#define BROADCAST_SAMPLE_RATE 24000
+BUILD_ASSERT(CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT % CONFIG_BT_BAP_BROADCAST_SRC_SUBGROUP_COUNT ==
+		     0,
+	     "Streams shall be evenly distributed over the subgroups");
 
-#elif defined(CONFIG_BAP_BROADCAST_48_2_1)
+BUILD_ASSERT(CONFIG_BT_ISO_MAX_CHAN >= CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT,
+	     "CONFIG_BT_ISO_MAX_CHAN should be at least CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT");
 
-static struct bt_bap_lc3_preset preset_active = BT_BAP_LC3_PRESET(BT_AUDIO_CODEC_LC3_CONFIG(BT_AUDIO_CODEC_CFG_FREQ_48KHZ,
-						    BT_AUDIO_CODEC_CFG_DURATION_10, BT_AUDIO_LOCATION_FRONT_LEFT | BT_AUDIO_LOCATION_FRONT_RIGHT, 100U, 1,
-						    BT_AUDIO_CONTEXT_TYPE_UNSPECIFIED),
-			  BT_BAP_QOS_CFG_UNFRAMED(10000u, 100u, 4u, 20u, 80000u));
+/* Audio location of the n-th channel of a subgroup. The layout repeats when a subgroup
+ * has more channels than the layout, e.g. one stereo pair per room.
+ */
+#if defined(CONFIG_BROADCAST_LAYOUT_QUAD)
+#define LAYOUT_LOCATION(_n)                                                                        \
+	((_n) % 4 == 0   ? BT_AUDIO_LOCATION_FRONT_LEFT                                            \
+	 : (_n) % 4 == 1 ? BT_AUDIO_LOCATION_FRONT_RIGHT                                           \
+	 : (_n) % 4 == 2 ? BT_AUDIO_LOCATION_BACK_LEFT                                             \
+			 : BT_AUDIO_LOCATION_BACK_RIGHT)
+#else
+#define LAYOUT_LOCATION(_n)                                                                        \
+	((_n) % 2 == 0 ? BT_AUDIO_LOCATION_FRONT_LEFT : BT_AUDIO_LOCATION_FRONT_RIGHT)
+#endif /* defined(CONFIG_BROADCAST_LAYOUT_QUAD) */
 
-static uint8_t left_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_48KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_LEFT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(100U)),
-};
+/* Audio locations of the stream at position _pos within its subgroup. With multiple
+ * channels per BIS, the LC3 frames of a stream are sent in ascending order of their
+ * location bits, i.e. left before right.
+ */
+#if defined(CONFIG_BROADCAST_MULTI_CHANNEL_BIS)
+#define STREAM_CHANNELS 2
+#define STREAM_LOCATION(_pos)                                                                      \
+	(LAYOUT_LOCATION(2 * (_pos)) | LAYOUT_LOCATION(2 * (_pos) + 1))
+#else
+#define STREAM_CHANNELS 1
+#define STREAM_LOCATION(_pos) LAYOUT_LOCATION(_pos)
+#endif /* defined(CONFIG_BROADCAST_MULTI_CHANNEL_BIS) */
 
-static uint8_t right_stream[] = {
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FREQ, (BT_AUDIO_CODEC_CFG_FREQ_48KHZ)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_DURATION, (BT_AUDIO_CODEC_CFG_DURATION_10)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC, BT_BYTES_LIST_LE32(BT_AUDIO_LOCATION_FRONT_RIGHT)),
-		BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_FRAME_LEN, BT_BYTES_LIST_LE16(100U)),
+/* Channel of the stereo input feeding channel _ch of the stream at position _pos within
+ * its subgroup. Left locations take the first channel and right locations the second one.
+ */
+#define STREAM_INPUT_CHANNEL(_pos, _ch) ((((_pos) * STREAM_CHANNELS) + (_ch)) % 2)
+
+/* The presets describe one channel per BIS, the SDUs of the BIG grow with the number of
+ * channels carried by each BIS.
+ */
+#define BROADCAST_MAX_SDU                                                                          \
+	(STREAM_CHANNELS * BROADCAST_FRAME_BLOCKS_PER_SDU * BROADCAST_OCTETS_PER_FRAME)
+
+BUILD_ASSERT(CONFIG_BT_ISO_TX_MTU >= BROADCAST_MAX_SDU,
+	     "CONFIG_BT_ISO_TX_MTU should hold the LC3 frames of all channels of a BIS");
+
+/* BIS level codec configuration, generated for every stream. Everything but the channel
+ * allocation is inherited from the subgroup, so that the same data works for subgroups
+ * at any preset.
+ */
+#define BIS_CODEC_DATA_SIZE 6
+#define BIS_CODEC_DATA(_i, ...)                                                                    \
+	{BT_AUDIO_CODEC_DATA(BT_AUDIO_CODEC_CFG_CHAN_ALLOC,                                        \
+			     BT_BYTES_LIST_LE32(STREAM_LOCATION((_i) % STREAMS_PER_SUBGROUP)))}
+
+static uint8_t bis_codec_data[][BIS_CODEC_DATA_SIZE] = {
+	LISTIFY(CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT, BIS_CODEC_DATA, (,))
 };
 
-#define BROADCAST_SAMPLE_RATE 48000
+BUILD_ASSERT(ARRAY_SIZE(bis_codec_data) == CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT,
+	     "Codec data not generated for every stream");
 
-#endif
+/**
+ * Get the preset of a subgroup.
+ *
+ * @param subgroup Index of the subgroup
+ *
+ * @return Index in broadcast_presets of the preset used by the subgroup.
+ */
+static size_t subgroup_preset_index(size_t subgroup)
+{
+	return MIN(subgroup, BROADCAST_PRESET_COUNT - 1);
+}
 
-#if defined(CONFIG_BAP_BROADCAST_16_2_1)
-#define MAX_SAMPLE_RATE 16000
-#elif defined(CONFIG_BAP_BROADCAST_24_2_1)
-#define MAX_SAMPLE_RATE 24000
-#elif defined(CONFIG_BAP_BROADCAST_48_2_1)
-#define MAX_SAMPLE_RATE 48000
-#endif
-#define MAX_FRAME_DURATION_US 10000
+static size_t stream_preset_index(size_t stream)
+{
+	return subgroup_preset_index(stream / STREAMS_PER_SUBGROUP);
+}
+
+/* The primary preset always has the highest sample rate */
+#define MAX_SAMPLE_RATE BROADCAST_SAMPLE_RATE
+#define MAX_FRAME_DURATION_US BROADCAST_FRAME_DURATION_US
+/* Audio carried by one SDU, and pulled from the USB ring buffers at once */
+#define MAX_SDU_DURATION_US   (MAX_FRAME_DURATION_US * BROADCAST_FRAME_BLOCKS_PER_SDU)
 #define MAX_NUM_SAMPLES       ((MAX_FRAME_DURATION_US * MAX_SAMPLE_RATE) / USEC_PER_SEC)
 
 #include "lc3.h"
+#include "pipeline_timing.h"
 
-#if defined(CONFIG_USB_DEVICE_AUDIO)
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+#if defined(CONFIG_USB_AUDIO_LEGACY)
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/class/usb_audio.h>
-#include <zephyr/sys/ring_buffer.h>
 
-/* USB Audio Data is downsampled from 48kHz to match broadcast preset when receiving data */
+#define USB_SUBSLOT_SIZE 2
+#else
+#include "usb_uac2.h"
+
+#define USB_SUBSLOT_SIZE USB_UAC2_SUBSLOT_SIZE
+#endif /* defined(CONFIG_USB_AUDIO_LEGACY) */
+
+/* USB Audio Data is downsampled from 48kHz to match broadcast preset when receiving data.
+ * Buffers are sized for the primary preset, which has the highest sample rate.
+ */
 #define USB_SAMPLE_RATE       48000
 #define USB_DOWNSAMPLE_RATE   BROADCAST_SAMPLE_RATE
 #define USB_FRAME_DURATION_US 1000
 #define USB_NUM_SAMPLES       ((USB_FRAME_DURATION_US * USB_DOWNSAMPLE_RATE) / USEC_PER_SEC)
+/* Samples are kept as 16 bits in the ring buffers whatever their size on the bus */
 #define USB_BYTES_PER_SAMPLE  2
 #define USB_CHANNELS          2
 
-#define RING_BUF_USB_FRAMES  20
-#define AUDIO_RING_BUF_BYTES (USB_NUM_SAMPLES * USB_BYTES_PER_SAMPLE * RING_BUF_USB_FRAMES)
-#else /* !defined(CONFIG_USB_DEVICE_AUDIO) */
-
-#include <math.h>
+BUILD_ASSERT(USB_SUBSLOT_SIZE >= 2 && USB_SUBSLOT_SIZE <= 4, "Unsupported USB sample size");
 
-#define AUDIO_VOLUME            (INT16_MAX - 3000) /* codec does clipping above INT16_MAX - 3000 */
-#define AUDIO_TONE_FREQUENCY_HZ 1000
+#define RING_BUF_USB_FRAMES  CONFIG_USB_RING_BUF_FRAMES
+#define AUDIO_RING_BUF_BYTES (USB_NUM_SAMPLES * USB_BYTES_PER_SAMPLE * RING_BUF_USB_FRAMES)
 
-/**
- * Use the math lib to generate a sine-wave using 16 bit samples into a buffer.
- *
- * @param buf Destination buffer
- * @param length_us Length of the buffer in microseconds
- * @param frequency_hz frequency in Hz
- * @param sample_rate_hz sample-rate in Hz.
+/* Audio buffered before the first SDU is encoded from USB data. After that the ring
+ * buffer level swings between the pre-fill and the pre-fill plus one SDU of audio.
  */
-static void fill_audio_buf_sin(int16_t *buf, int length_us, int frequency_hz, int sample_rate_hz)
-{
-	const int sine_period_samples = sample_rate_hz / frequency_hz;
-	const unsigned int num_samples = (length_us * sample_rate_hz) / USEC_PER_SEC;
-	const float step = 2 * 3.1415f / sine_period_samples;
+#define USB_PREFILL_FRAMES     CONFIG_USB_PREFILL_FRAMES
+#define USB_PREFILL_BYTES      (USB_NUM_SAMPLES * USB_BYTES_PER_SAMPLE * USB_PREFILL_FRAMES)
+#define USB_PREFILL_TIMEOUT_MS 100
+
+BUILD_ASSERT(RING_BUF_USB_FRAMES * USB_FRAME_DURATION_US >=
+		     (USB_PREFILL_FRAMES + 1) * USB_FRAME_DURATION_US + MAX_SDU_DURATION_US,
+	     "CONFIG_USB_RING_BUF_FRAMES should hold at least CONFIG_USB_PREFILL_FRAMES, one "
+	     "SDU of audio and one USB frame of headroom");
+
+#include "decimator.h"
+
+BUILD_ASSERT(USB_SAMPLE_RATE % USB_DOWNSAMPLE_RATE == 0 &&
+		     USB_SAMPLE_RATE / USB_DOWNSAMPLE_RATE <= DECIMATOR_MAX_RATIO,
+	     "USB sample rate is not an integer multiple of the broadcast sample rate");
+BUILD_ASSERT((USB_FRAME_DURATION_US * USB_SAMPLE_RATE) / USEC_PER_SEC <=
+		     DECIMATOR_MAX_INPUT_SAMPLES,
+	     "USB frame does not fit in the decimator");
+#if defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP)
+BUILD_ASSERT(USB_SAMPLE_RATE % SECONDARY_SAMPLE_RATE == 0 &&
+		     USB_SAMPLE_RATE / SECONDARY_SAMPLE_RATE <= DECIMATOR_MAX_RATIO,
+	     "USB sample rate is not an integer multiple of the secondary sample rate");
+#endif /* defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP) */
+#else /* !defined(CONFIG_USE_USB_AUDIO_INPUT) */
+#include "tone_generator.h"
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+struct broadcast_source_stream_stats {
+	/* Samples the USB ring buffer was short of when encoding, padded with silence */
+	uint32_t underrun_samples;
+	/* USB audio bytes dropped because the ring buffer was full */
+	uint32_t overrun_bytes;
+	/* SDUs that had to wait for a free TX buffer */
+	uint32_t alloc_waits;
+	/* Failed bt_bap_stream_send() calls */
+	uint32_t send_errors;
+	/* SDUs sent more than one SDU interval after the sent callback requesting them */
+	uint32_t late_sdus;
+	/* SDUs dropped because no TX buffer became free before their deadline, or because
+	 * they could not be encoded
+	 */
+	uint32_t dropped_sdus;
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	/* Silent SDUs sent from the cache instead of being encoded */
+	uint32_t cached_sdus;
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+};
+
+/* Codec parameters of a preset, parsed from its codec configuration by the encoder thread */
+struct broadcast_codec_params {
+	int freq_hz;
+	int frame_duration_us;
+	int frames_per_sdu;
+	int octets_per_frame;
+	/* PCM samples per codec frame */
+	size_t num_samples;
+	/* Octets of one SDU, holding a codec frame for each channel of the stream */
+	size_t sdu_len;
+};
 
-	for (unsigned int i = 0; i < num_samples; i++) {
-		const float sample = sinf(i * step);
+static struct broadcast_codec_params codec_params[BROADCAST_PRESET_COUNT];
 
-		buf[i] = (int16_t)(AUDIO_VOLUME * sample);
-	}
-}
-#endif /* defined(CONFIG_USB_DEVICE_AUDIO) */
+/* LC3 encoder state sized for the most demanding preset of the broadcast, instead of
+ * liblc3's 10 ms / 48 kHz worst case. All other presets have a lower sample rate and the
+ * same frame duration, so they fit in it as well.
+ */
+typedef LC3_ENCODER_MEM_T(MAX_FRAME_DURATION_US, MAX_SAMPLE_RATE) broadcast_lc3_encoder_mem_t;
 
+/* Per-stream state used by every SDU, kept small and together */
 static struct broadcast_source_stream {
-	struct bt_bap_stream stream;
+	/* Codec parameters of the subgroup the stream belongs to */
+	const struct broadcast_codec_params *codec;
+	/* One encoder per channel carried by the stream */
+	lc3_encoder_t lc3_encoder[STREAM_CHANNELS];
 	uint16_t seq_num;
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	/* Number of SDUs to send as silence before pulling from the ring buffer */
+	uint8_t silent_frames;
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	/* Consecutive SDUs of silence, see quiet_sdu_update() */
+	uint32_t quiet_sdus;
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+	uint32_t sent_cycles;
 	size_t sent_cnt;
-	lc3_encoder_t lc3_encoder;
-	lc3_encoder_mem_48k_t lc3_encoder_mem;
-#if defined(CONFIG_USB_DEVICE_AUDIO)
-	struct ring_buf audio_ring_buf;
-	uint8_t _ring_buffer_memory[AUDIO_RING_BUF_BYTES];
-#endif /* defined(CONFIG_USB_DEVICE_AUDIO) */
+#if defined(CONFIG_PIPELINE_TIMING)
+	pipeline_timestamp_t sent_timestamp;
+#endif /* defined(CONFIG_PIPELINE_TIMING) */
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	/* When the SDU being encoded was requested */
+	uint32_t request_cycles;
+	/* Peak time from an SDU request until it was sent */
+	uint32_t encode_us;
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+	struct broadcast_source_stream_stats stats;
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	struct ring_buf audio_ring_buf[STREAM_CHANNELS];
+#else
+	struct tone_generator tone[STREAM_CHANNELS];
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	struct k_sem encoder_sem;
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+	struct bt_bap_stream stream;
 } streams[CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT];
+
+/* Bulky per-stream memory, indexed like streams[] and only touched through pointers */
+static struct broadcast_source_stream_storage {
+	broadcast_lc3_encoder_mem_t lc3_encoder_mem[STREAM_CHANNELS];
+	/* PCM frame to be encoded, private to the stream so that streams can be encoded
+	 * independently of each other. Channels are encoded one after another.
+	 */
+	int16_t pcm_data[MAX_NUM_SAMPLES];
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	/* Aligned for the decimator to write samples straight into it */
+	uint8_t __aligned(sizeof(int16_t)) ring_buffer_memory[STREAM_CHANNELS][AUDIO_RING_BUF_BYTES];
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	/* Encoded silence, sent while the input stays silent */
+	uint8_t silent_sdu[BROADCAST_MAX_SDU];
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	struct k_thread encoder_thread;
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	/* Requests the next SDU when it is due, see stream_sdu_schedule() */
+	struct k_timer encode_timer;
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+} stream_storage[CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT];
+
+static struct broadcast_source_stream_storage *
+stream_storage_get(const struct broadcast_source_stream *source_stream)
+{
+	return &stream_storage[source_stream - streams];
+}
+
 static struct bt_bap_broadcast_source *broadcast_source;
 
+/* Settings applied each time the broadcast source is created */
+struct broadcast_settings {
+	char name[BT_AUDIO_BROADCAST_NAME_LEN_MAX + 1];
+	/* No Broadcast Code for an unencrypted broadcast */
+	uint8_t code[BT_ISO_BROADCAST_CODE_SIZE];
+	size_t code_len;
+	/* QoS half of the preset, the codec configuration is fixed at build time */
+	uint8_t rtn;
+	uint16_t latency_ms;
+	uint32_t pd_us;
+};
+
+static struct broadcast_settings settings = {
+	.name = CONFIG_BT_DEVICE_NAME,
+	.code = CONFIG_BROADCAST_CODE,
+	.code_len = sizeof(CONFIG_BROADCAST_CODE) - 1U,
+	.rtn = CONFIG_BROADCAST_RTN,
+	.latency_ms = CONFIG_BROADCAST_MAX_TRANSPORT_LATENCY_MS,
+	.pd_us = CONFIG_BROADCAST_PRESENTATION_DELAY_US,
+};
+static K_MUTEX_DEFINE(settings_lock);
+
+/* Requests to the control loop in main() */
+enum broadcast_request {
+	/* Start again with the current settings */
+	BROADCAST_REQUEST_RESTART,
+	/* Stop the BIG while the input is silent, the periodic advertising keeps running */
+	BROADCAST_REQUEST_SUSPEND,
+	/* Start the suspended BIG again */
+	BROADCAST_REQUEST_RESUME,
+
+	BROADCAST_REQUEST_COUNT,
+};
+
+static ATOMIC_DEFINE(broadcast_requests, BROADCAST_REQUEST_COUNT);
+static K_SEM_DEFINE(control_sem, 0U, 1U);
+
+static void broadcast_request(enum broadcast_request request)
+{
+	if (!atomic_test_and_set_bit(broadcast_requests, request)) {
+		k_sem_give(&control_sem);
+	}
+}
+
+/* Cleared while the broadcast source is restarted, so that SDUs still requested for the
+ * previous BIG do not use up sequence numbers of the next one.
+ */
+static atomic_t broadcasting;
+
 NET_BUF_POOL_FIXED_DEFINE(tx_pool, TOTAL_BUF_NEEDED, BT_ISO_SDU_BUF_SIZE(CONFIG_BT_ISO_TX_MTU),
 			  CONFIG_BT_CONN_TX_USER_DATA_SIZE, NULL);
 
-static int16_t send_pcm_data[MAX_NUM_SAMPLES];
-
 static K_SEM_DEFINE(sem_started, 0U, ARRAY_SIZE(streams));
 static K_SEM_DEFINE(sem_stopped, 0U, ARRAY_SIZE(streams));
 
-#define BROADCAST_SOURCE_LIFETIME 120U /* seconds */
-
-static int freq_hz;
-static int frame_duration_us;
-static int frames_per_sdu;
-static int octets_per_frame;
+#if CONFIG_BROADCAST_RESTART_INTERVAL_S > 0
+#define BROADCAST_RESTART_TIMEOUT K_SECONDS(CONFIG_BROADCAST_RESTART_INTERVAL_S)
+#else
+#define BROADCAST_RESTART_TIMEOUT K_FOREVER
+#endif /* CONFIG_BROADCAST_RESTART_INTERVAL_S > 0 */
 
+#if !defined(CONFIG_ENCODER_THREAD_PER_STREAM)
 static K_SEM_DEFINE(lc3_encoder_sem, 0U, TOTAL_BUF_NEEDED);
+#endif /* !defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+
+/* Length of an AD structure, with its length and AD type octets */
+#define AD_STRUCT_SIZE(data_len) (2U + (data_len))
+
+#if defined(CONFIG_BROADCAST_VENDOR_AD)
+/* Manufacturer specific data of the extended advertising */
+struct vendor_ad {
+	uint8_t company_id[2];
+	uint8_t reserved[CONFIG_BROADCAST_VENDOR_AD_RESERVED_LEN];
+	uint8_t tag[2];
+} __packed;
+
+static const struct vendor_ad vendor_ad = {
+	.company_id = {BT_BYTES_LIST_LE16(CONFIG_BROADCAST_VENDOR_COMPANY_ID)},
+	.tag = {BT_BYTES_LIST_LE16(CONFIG_BROADCAST_VENDOR_TAG)},
+};
 
-static uint8_t ad_data_1[] = {0x57, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-								0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-								0x00, 0x00, 0xDF, 0xFD};
-
-static uint8_t per_ad_data_1[] = {0xDF, 0xFD, 0x02, 0x02, 0x00};
-static uint8_t per_ad_data_2[] = {0x81, 0x00, 0x00, 0x00, 0x08, 0x08, 0x24,
-									0x70, 0x02, 0x00, 0x70, 0x02, 0x40, 0x64,
-									0x00, 0x6C, 0xED, 0x9C, 0x6C, 0x10, 0x27,
-									0x40, 0x06, 0x33, 0x33, 0xFF, 0xFF, 0xFF,
-									0xFF, 0x3F, 0xAF, 0x0D, 0x00, 0x00, 0x00,
-									0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-									0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-									0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-									0x00, 0x00};
+/* Manufacturer specific data of the periodic advertising, starting with the tag */
+struct vendor_per_ad_info {
+	uint8_t tag[2];
+	uint8_t info[3];
+} __packed;
 
-static void send_data(struct broadcast_source_stream *source_stream)
+static const struct vendor_per_ad_info vendor_per_ad_info = {
+	.tag = {BT_BYTES_LIST_LE16(CONFIG_BROADCAST_VENDOR_TAG)},
+	.info = {BT_BYTES_LIST_LE24(CONFIG_BROADCAST_VENDOR_PA_INFO)},
+};
+
+#define VENDOR_EXT_AD_COUNT 1U
+#define VENDOR_EXT_AD_LEN   AD_STRUCT_SIZE(sizeof(struct vendor_ad))
+
+#if defined(CONFIG_BROADCAST_VENDOR_PA_STREAM_INFO)
+/* The layout of the description is defined by the vendor, it is sent as captured */
+#define VENDOR_STREAM_DESCRIPTION                                                                  \
+	0x00, 0x00, 0x08, 0x08, 0x24, 0x70, 0x02, 0x00, 0x70, 0x02, 0x40, 0x64, 0x00, 0x6C, 0xED, \
+	0x9C, 0x6C, 0x10, 0x27, 0x40, 0x06, 0x33, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F, 0xAF, 0x0D
+
+struct vendor_per_ad_stream {
+	uint8_t company_id[2];
+	uint8_t description[NUM_VA_ARGS(VENDOR_STREAM_DESCRIPTION)];
+	uint8_t padding[CONFIG_BROADCAST_VENDOR_PA_STREAM_PADDING_LEN];
+} __packed;
+
+static const struct vendor_per_ad_stream vendor_per_ad_stream = {
+	.company_id = {BT_BYTES_LIST_LE16(CONFIG_BROADCAST_VENDOR_PA_STREAM_COMPANY_ID)},
+	.description = {VENDOR_STREAM_DESCRIPTION},
+};
+
+#define VENDOR_PER_AD_COUNT 2U
+#define VENDOR_PER_AD_LEN                                                                          \
+	(AD_STRUCT_SIZE(sizeof(struct vendor_per_ad_info)) +                                       \
+	 AD_STRUCT_SIZE(sizeof(struct vendor_per_ad_stream)))
+#else
+#define VENDOR_PER_AD_COUNT 1U
+#define VENDOR_PER_AD_LEN   AD_STRUCT_SIZE(sizeof(struct vendor_per_ad_info))
+#endif /* defined(CONFIG_BROADCAST_VENDOR_PA_STREAM_INFO) */
+#else
+#define VENDOR_EXT_AD_COUNT 0U
+#define VENDOR_EXT_AD_LEN   0U
+#define VENDOR_PER_AD_COUNT 0U
+#define VENDOR_PER_AD_LEN   0U
+#endif /* defined(CONFIG_BROADCAST_VENDOR_AD) */
+
+/* Broadcast Audio Announcement, Broadcast Name and vendor data */
+#define EXT_AD_COUNT (2U + VENDOR_EXT_AD_COUNT)
+#define EXT_AD_LEN(name_len)                                                                       \
+	(AD_STRUCT_SIZE(BT_UUID_SIZE_16 + BT_AUDIO_BROADCAST_ID_SIZE) +                            \
+	 AD_STRUCT_SIZE(name_len) + VENDOR_EXT_AD_LEN)
+
+BUILD_ASSERT(EXT_AD_LEN(sizeof(CONFIG_BT_DEVICE_NAME) - 1U) <= CONFIG_BROADCAST_ADV_DATA_LEN_MAX,
+	     "Extended advertising data exceeds CONFIG_BROADCAST_ADV_DATA_LEN_MAX");
+
+/* Longest Broadcast Name that can be set at runtime */
+#define BROADCAST_NAME_LEN_MAX                                                                     \
+	MIN(BT_AUDIO_BROADCAST_NAME_LEN_MAX, CONFIG_BROADCAST_ADV_DATA_LEN_MAX - EXT_AD_LEN(0U))
+
+/*
+ * Smallest possible BASE: UUID, presentation delay and subgroup count, then per subgroup the
+ * BIS count, codec ID and empty codec configuration and metadata, and per BIS its index and
+ * empty codec configuration. The actual size is checked once the BASE is encoded.
+ */
+#define BASE_LEN_MIN                                                                               \
+	(BT_UUID_SIZE_16 + 3U + 1U + CONFIG_BT_BAP_BROADCAST_SRC_SUBGROUP_COUNT * (1U + 5U + 1U + 1U) + \
+	 CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT * (1U + 1U))
+
+/* BASE and vendor data */
+#define PER_AD_COUNT (1U + VENDOR_PER_AD_COUNT)
+
+BUILD_ASSERT(AD_STRUCT_SIZE(BASE_LEN_MIN) + VENDOR_PER_AD_LEN <= CONFIG_BROADCAST_ADV_DATA_LEN_MAX,
+	     "Periodic advertising data exceeds CONFIG_BROADCAST_ADV_DATA_LEN_MAX");
+
+/* Ask the encoder for the next SDU of a stream */
+static void stream_sdu_request(struct broadcast_source_stream *source_stream)
 {
-	struct bt_bap_stream *stream = &source_stream->stream;
-	struct net_buf *buf;
-	int ret;
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	source_stream->request_cycles = k_cycle_get_32();
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
 
-	buf = net_buf_alloc(&tx_pool, K_FOREVER);
-	if (buf == NULL) {
-		printk("Could not allocate buffer when sending on %p\n", stream);
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	k_sem_give(&source_stream->encoder_sem);
+#else
+	k_sem_give(&lc3_encoder_sem);
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+}
+
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+/* Each stream has a single encode timer, which a second SDU in flight would restart */
+BUILD_ASSERT(CONFIG_BROADCAST_ENQUEUE_COUNT == 1,
+	     "CONFIG_BROADCAST_JIT_ENCODE needs CONFIG_BROADCAST_ENQUEUE_COUNT of 1");
+
+static void encode_timer_expired(struct k_timer *timer)
+{
+	stream_sdu_request(k_timer_user_data_get(timer));
+}
+
+/* Track the time from an SDU request until it was sent: increases are followed at once,
+ * decreases slowly, so that a single quick SDU does not make the next one late.
+ */
+static void encode_duration_update(struct broadcast_source_stream *source_stream)
+{
+	const uint32_t encode_us =
+		k_cyc_to_us_ceil32(k_cycle_get_32() - source_stream->request_cycles);
+
+	if (encode_us > source_stream->encode_us) {
+		source_stream->encode_us = encode_us;
+	} else {
+		source_stream->encode_us -= (source_stream->encode_us - encode_us) >> 4;
+	}
+}
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+
+/* Request the SDU for the BIG event one ISO interval after sent_cycles. Unless encoding
+ * just in time, it is requested right away and then waits in the controller queue.
+ */
+static void stream_sdu_schedule(struct broadcast_source_stream *source_stream)
+{
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	const uint32_t interval_us = preset_active.qos.interval;
+	const uint32_t budget_us = source_stream->encode_us + CONFIG_BROADCAST_JIT_MARGIN_US;
+	const uint32_t due_us = interval_us > budget_us ? interval_us - budget_us : 0U;
+	const uint32_t elapsed_us =
+		k_cyc_to_us_floor32(k_cycle_get_32() - source_stream->sent_cycles);
+
+	if (due_us > elapsed_us) {
+		k_timer_start(&stream_storage_get(source_stream)->encode_timer,
+			      K_USEC(due_us - elapsed_us), K_NO_WAIT);
 		return;
 	}
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
 
-	net_buf_reserve(buf, BT_ISO_CHAN_SEND_RESERVE);
-	uint8_t lc3_encoded_buffer[preset_active.qos.sdu];
+	stream_sdu_request(source_stream);
+}
 
-	if (source_stream->lc3_encoder == NULL) {
-		printk("LC3 encoder not setup, cannot encode data.\n");
-		net_buf_unref(buf);
-		return;
+/* Time left to get a TX buffer for the SDU requested by the last sent callback. Past one
+ * ISO interval the BIG event the SDU was meant for is gone, and sending it anyway would
+ * only add latency.
+ */
+static k_timeout_t sdu_alloc_timeout(const struct broadcast_source_stream *source_stream)
+{
+	const uint32_t elapsed_us =
+		k_cyc_to_us_floor32(k_cycle_get_32() - source_stream->sent_cycles);
+
+	if (elapsed_us >= preset_active.qos.interval) {
+		return K_NO_WAIT;
+	}
+
+	return K_USEC(preset_active.qos.interval - elapsed_us);
+}
+
+/* Give up on the next SDU of a stream. pcm_taken tells whether its audio has already been
+ * read from the ring buffers.
+ */
+static void drop_sdu(struct broadcast_source_stream *source_stream, bool pcm_taken)
+{
+	source_stream->stats.dropped_sdus++;
+	/* Keep the sequence number in step with the BIG event the SDU was meant for */
+	source_stream->seq_num++;
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	if (!pcm_taken && source_stream->silent_frames > 0U) {
+		source_stream->silent_frames--;
+	} else if (!pcm_taken) {
+		const struct broadcast_codec_params *codec = source_stream->codec;
+
+		/* Discard the audio of the dropped SDU so that the ring buffer does not grow */
+		for (size_t i = 0U; i < STREAM_CHANNELS; i++) {
+			(void)ring_buf_get(&source_stream->audio_ring_buf[i], NULL,
+					   codec->frames_per_sdu * codec->num_samples *
+						   sizeof(int16_t));
+		}
 	}
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+	/* No sent callback follows a dropped SDU, so request the next one ourselves. Its
+	 * deadline is one ISO interval later.
+	 */
+	source_stream->sent_cycles += k_us_to_cyc_ceil32(preset_active.qos.interval);
+	stream_sdu_schedule(source_stream);
+}
+
+#if defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS)
+/* BIG timing reference shared by all streams: the SDUs with sequence number seq_num are sent
+ * in the BIG event with timestamp ts. Read from the first stream, valid for all of them.
+ */
+static struct {
+	struct k_spinlock lock;
+	bool valid;
+	uint32_t ts;
+	uint16_t seq_num;
+} big_tx_ref;
+
+static void big_tx_ref_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&big_tx_ref.lock);
+
+	big_tx_ref.valid = false;
+	k_spin_unlock(&big_tx_ref.lock, key);
+}
 
-#if defined(CONFIG_USB_DEVICE_AUDIO)
-	uint32_t size = ring_buf_get(&source_stream->audio_ring_buf, (uint8_t *)send_pcm_data,
-				     sizeof(send_pcm_data));
+static void big_tx_ref_sync(struct broadcast_source_stream *source_stream)
+{
+	struct bt_iso_tx_info info;
+	k_spinlock_key_t key;
+	int err;
 
-	if (size < sizeof(send_pcm_data)) {
-		const size_t padding_size = sizeof(send_pcm_data) - size;
+	/* The SDUs queued by main() have no sent callback of their own: only once they are
+	 * all out has the controller got a sent SDU to report the timing of.
+	 */
+	if (source_stream != &streams[0] || source_stream->sent_cnt < BROADCAST_ENQUEUE_COUNT) {
+		return;
+	}
 
-		memset(&((uint8_t *)send_pcm_data)[size], 0, padding_size);
+	key = k_spin_lock(&big_tx_ref.lock);
+	if (big_tx_ref.valid) {
+		k_spin_unlock(&big_tx_ref.lock, key);
+		return;
 	}
-#endif
+	k_spin_unlock(&big_tx_ref.lock, key);
 
-	ret = lc3_encode(source_stream->lc3_encoder, LC3_PCM_FORMAT_S16, send_pcm_data, 1,
-			 octets_per_frame, lc3_encoded_buffer);
-	if (ret == -1) {
-		printk("LC3 encoder failed - wrong parameters?: %d", ret);
-		net_buf_unref(buf);
+	err = bt_bap_stream_get_tx_sync(&source_stream->stream, &info);
+	if (err != 0) {
+		LOG_RATELIMIT(LOG_WRN, "Unable to read TX sync of %p: %d",
+			      &source_stream->stream, err);
 		return;
 	}
 
-	net_buf_add_mem(buf, lc3_encoded_buffer, preset_active.qos.sdu);
+	LOG_INF("BIG reference: SDU %u at %u us", info.seq_num, info.ts);
 
-	ret = bt_bap_stream_send(stream, buf, source_stream->seq_num++);
-	if (ret < 0) {
-		/* This will end broadcasting on this stream. */
-		printk("Unable to broadcast data on %p: %d\n", stream, ret);
-		net_buf_unref(buf);
+	key = k_spin_lock(&big_tx_ref.lock);
+	big_tx_ref.ts = info.ts;
+	big_tx_ref.seq_num = info.seq_num;
+	big_tx_ref.valid = true;
+	k_spin_unlock(&big_tx_ref.lock, key);
+}
+
+/* Timestamp of the BIG event the SDU with the given sequence number is sent in */
+static bool big_tx_ref_ts(uint16_t seq_num, uint32_t *ts)
+{
+	k_spinlock_key_t key = k_spin_lock(&big_tx_ref.lock);
+	const bool valid = big_tx_ref.valid;
+
+	if (valid) {
+		/* SDUs sequenced before the reference, e.g. queued before a re-reference,
+		 * are timestamped before it rather than a whole sequence number wrap ahead.
+		 * The timestamps wrap at 2^32 us like the controller's.
+		 */
+		const int32_t delta = (int16_t)(seq_num - big_tx_ref.seq_num);
+
+		*ts = big_tx_ref.ts + (uint32_t)(delta * (int32_t)preset_active.qos.interval);
+	}
+	k_spin_unlock(&big_tx_ref.lock, key);
+
+	return valid;
+}
+#endif /* defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS) */
+
+static int stream_send(struct broadcast_source_stream *source_stream, struct net_buf *buf)
+{
+	const uint16_t seq_num = source_stream->seq_num++;
+
+#if defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS)
+	uint32_t ts;
+
+	if (big_tx_ref_ts(seq_num, &ts)) {
+		return bt_bap_stream_send_ts(&source_stream->stream, buf, seq_num, ts);
+	}
+#endif /* defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS) */
+
+	return bt_bap_stream_send(&source_stream->stream, buf, seq_num);
+}
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+/* SDUs of silence before the cached silent SDU is used, and before the BIG is suspended.
+ * Set from the ISO interval when the broadcast source is started.
+ */
+static uint32_t quiet_hold_sdus;
+static uint32_t quiet_suspend_sdus;
+
+/* Set by main() while the BIG is suspended, until USB audio comes back */
+static atomic_t suspended;
+
+static bool pcm_quiet(const int16_t *pcm, size_t nsamples)
+{
+	for (size_t i = 0U; i < nsamples; i++) {
+		if (pcm[i] > CONFIG_BROADCAST_SILENCE_LEVEL ||
+		    pcm[i] < -CONFIG_BROADCAST_SILENCE_LEVEL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool streams_quiet_for(uint32_t sdus)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		if (streams[i].quiet_sdus < sdus) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Account for an SDU that was sent, caching it as the silent SDU of the stream once the
+ * input has been silent for quiet_hold_sdus.
+ */
+static void quiet_sdu_update(struct broadcast_source_stream *source_stream, bool quiet,
+			     const uint8_t *sdu, size_t sdu_len)
+{
+	if (!quiet) {
+		source_stream->quiet_sdus = 0U;
 		return;
 	}
 
-	source_stream->sent_cnt++;
-	if ((source_stream->sent_cnt % 1000U) == 0U) {
-		printk("Stream %p: Sent %u total ISO packets\n", stream, source_stream->sent_cnt);
+	if (source_stream->quiet_sdus < UINT32_MAX) {
+		source_stream->quiet_sdus++;
+	}
+
+	if (source_stream->quiet_sdus == quiet_hold_sdus) {
+		(void)memcpy(stream_storage_get(source_stream)->silent_sdu, sdu, sdu_len);
+	}
+
+	if (quiet_suspend_sdus > 0U && source_stream->quiet_sdus >= quiet_suspend_sdus &&
+	    streams_quiet_for(quiet_suspend_sdus)) {
+		broadcast_request(BROADCAST_REQUEST_SUSPEND);
 	}
 }
 
-static void init_lc3_thread(void *arg1, void *arg2, void *arg3)
+/* Start the encoders of a stream over once it stops sending the cached silent SDU. They have
+ * not seen the SDUs that were sent from the cache, so their state still follows the audio
+ * from before and would be applied to the audio coming back.
+ */
+static void lc3_encoders_reset(struct broadcast_source_stream *source_stream)
+{
+	const struct broadcast_codec_params *codec = source_stream->codec;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(source_stream->lc3_encoder); i++) {
+		source_stream->lc3_encoder[i] =
+			lc3_setup_encoder(codec->frame_duration_us, codec->freq_hz, 0,
+					  &stream_storage_get(source_stream)->lc3_encoder_mem[i]);
+	}
+}
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+static void send_data(struct broadcast_source_stream *source_stream)
 {
-	const struct bt_audio_codec_cfg *codec_cfg = &preset_active.codec_cfg;
+	struct bt_bap_stream *stream = &source_stream->stream;
+	const struct broadcast_codec_params *codec = source_stream->codec;
+	int16_t *pcm_data = stream_storage_get(source_stream)->pcm_data;
+	pipeline_timestamp_t alloc_timestamp;
+	pipeline_timestamp_t encode_timestamp;
+	struct net_buf *buf;
+	uint8_t *sdu;
 	int ret;
 
-	ret = bt_audio_codec_cfg_get_freq(codec_cfg);
-	if (ret > 0) {
-		freq_hz = bt_audio_codec_cfg_freq_to_freq_hz(ret);
-	} else {
+	if (!atomic_get(&broadcasting)) {
+		return;
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(source_stream->lc3_encoder); i++) {
+		if (source_stream->lc3_encoder[i] == NULL) {
+			LOG_RATELIMIT(LOG_ERR, "LC3 encoder not setup, cannot encode data.");
+			return;
+		}
+	}
+
+	buf = net_buf_alloc(&tx_pool, K_NO_WAIT);
+	if (buf == NULL) {
+		source_stream->stats.alloc_waits++;
+		buf = net_buf_alloc(&tx_pool, sdu_alloc_timeout(source_stream));
+	}
+
+	if (buf == NULL) {
+		LOG_RATELIMIT(LOG_WRN, "No TX buffer in time for %p, dropping SDU %u",
+			      &source_stream->stream, source_stream->seq_num);
+		drop_sdu(source_stream, false);
+		return;
+	}
+
+	alloc_timestamp = pipeline_timing_now();
+
+	net_buf_reserve(buf, BT_ISO_CHAN_SEND_RESERVE);
+	if (net_buf_tailroom(buf) < codec->sdu_len) {
+		LOG_RATELIMIT(LOG_ERR, "SDU of %zu octets does not fit in TX buffer",
+			      codec->sdu_len);
+		net_buf_unref(buf);
+		drop_sdu(source_stream, false);
 		return;
 	}
 
-	ret = bt_audio_codec_cfg_get_frame_dur(codec_cfg);
-	if (ret > 0) {
-		frame_duration_us = bt_audio_codec_cfg_frame_dur_to_frame_dur_us(ret);
-	} else {
-		printk("Error: Frame duration not set, cannot start codec.");
-		return;
-	}
+	/* Encode straight into the buffer data area to avoid an intermediate copy */
+	sdu = net_buf_add(buf, codec->sdu_len);
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	const size_t pcm_size = codec->num_samples * sizeof(int16_t);
+	const bool silent = source_stream->silent_frames > 0U;
+
+	if (silent) {
+		/* Fill the controller queue without eating into the pre-fill */
+		source_stream->silent_frames--;
+	}
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	const uint8_t *silent_sdu = stream_storage_get(source_stream)->silent_sdu;
+	/* The pre-fill silence does not count, it is not the input going quiet */
+	bool quiet = !silent;
+	bool cached = quiet && source_stream->quiet_sdus > quiet_hold_sdus;
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+	/* The SDU holds the codec frame blocks in time order, each block holding one frame per
+	 * channel. All frames are encoded in one go to save wakeups and buffer allocations.
+	 */
+	encode_timestamp = pipeline_timing_now();
+	for (size_t i = 0U; i < (size_t)codec->frames_per_sdu * STREAM_CHANNELS; i++) {
+		const size_t channel = i % STREAM_CHANNELS;
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+		if (silent) {
+			memset(pcm_data, 0, pcm_size);
+		} else {
+			uint32_t size = ring_buf_get(&source_stream->audio_ring_buf[channel],
+						     (uint8_t *)pcm_data, pcm_size);
+
+			if (size < pcm_size) {
+				const size_t padding_size = pcm_size - size;
+
+				source_stream->stats.underrun_samples +=
+					padding_size / sizeof(int16_t);
+
+				memset(&((uint8_t *)pcm_data)[size], 0, padding_size);
+			}
+		}
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+		if (quiet && !pcm_quiet(pcm_data, codec->num_samples)) {
+			if (cached) {
+				lc3_encoders_reset(source_stream);
+			}
+			quiet = false;
+			cached = false;
+		}
+
+		if (cached) {
+			/* The ring buffer was drained all the same, so audio coming back is
+			 * noticed with the next frame.
+			 */
+			(void)memcpy(&sdu[i * codec->octets_per_frame],
+				     &silent_sdu[i * codec->octets_per_frame],
+				     codec->octets_per_frame);
+			continue;
+		}
+
+		if (quiet && source_stream->quiet_sdus + 1U == quiet_hold_sdus) {
+			/* The SDU to be cached is encoded from digital silence */
+			memset(pcm_data, 0, pcm_size);
+		}
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+#else
+		tone_generator_fill(&source_stream->tone[channel], pcm_data, codec->num_samples);
+#endif
+
+		ret = lc3_encode(source_stream->lc3_encoder[channel], LC3_PCM_FORMAT_S16, pcm_data,
+				 1, codec->octets_per_frame, &sdu[i * codec->octets_per_frame]);
+		if (ret == -1) {
+			LOG_RATELIMIT(LOG_ERR, "LC3 encoder failed - wrong parameters?: %d", ret);
+			net_buf_unref(buf);
+			drop_sdu(source_stream, true);
+			return;
+		}
+	}
+	pipeline_timing_record(PIPELINE_TIMING_ENCODE, encode_timestamp);
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	if (cached) {
+		source_stream->stats.cached_sdus++;
+	}
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+	ret = stream_send(source_stream, buf);
+	if (ret < 0) {
+		/* This will end broadcasting on this stream. */
+		LOG_RATELIMIT(LOG_ERR, "Unable to broadcast data on %p: %d", stream, ret);
+		source_stream->stats.send_errors++;
+		net_buf_unref(buf);
+		return;
+	}
+
+	if (k_cyc_to_us_floor32(k_cycle_get_32() - source_stream->sent_cycles) >
+	    preset_active.qos.interval) {
+		source_stream->stats.late_sdus++;
+	}
+
+	pipeline_timing_record(PIPELINE_TIMING_ALLOC_TO_SEND, alloc_timestamp);
+#if defined(CONFIG_PIPELINE_TIMING)
+	pipeline_timing_record(PIPELINE_TIMING_SENT_TO_SEND, source_stream->sent_timestamp);
+#endif /* defined(CONFIG_PIPELINE_TIMING) */
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	encode_duration_update(source_stream);
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	quiet_sdu_update(source_stream, quiet, sdu, codec->sdu_len);
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+	source_stream->sent_cnt++;
+	if ((source_stream->sent_cnt % 1000U) == 0U) {
+		LOG_INF("Stream %p: Sent %zu total ISO packets", stream, source_stream->sent_cnt);
+	}
+
+#if defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS)
+	big_tx_ref_sync(source_stream);
+#endif /* defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS) */
+}
+
+#define LC3_ENCODER_STACK_SIZE 4 * 4096
+#define LC3_ENCODER_PRIORITY   5
+
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+#define LC3_ENCODER_WORKER_STACK_SIZE 2 * 4096
+
+#if CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT > 1
+/* The first stream is encoded on the encoder thread itself */
+static K_THREAD_STACK_ARRAY_DEFINE(encoder_worker_stacks,
+				   CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT - 1,
+				   LC3_ENCODER_WORKER_STACK_SIZE);
+#endif /* CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT > 1 */
+
+static void encoder_worker_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct broadcast_source_stream *source_stream = arg1;
+
+	while (true) {
+		k_sem_take(&source_stream->encoder_sem, K_FOREVER);
+		send_data(source_stream);
+	}
+}
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+
+/**
+ * Parse the LC3 parameters of a codec configuration.
+ *
+ * @param codec_cfg Codec configuration of a preset
+ * @param[out] params Parsed parameters
+ *
+ * @return 0 on success, a negative value if a mandatory parameter is missing.
+ */
+static int codec_params_parse(const struct bt_audio_codec_cfg *codec_cfg,
+			      struct broadcast_codec_params *params)
+{
+	int ret;
+
+	ret = bt_audio_codec_cfg_get_freq(codec_cfg);
+	if (ret > 0) {
+		params->freq_hz = bt_audio_codec_cfg_freq_to_freq_hz(ret);
+	} else {
+		return -EINVAL;
+	}
+
+	ret = bt_audio_codec_cfg_get_frame_dur(codec_cfg);
+	if (ret > 0) {
+		params->frame_duration_us = bt_audio_codec_cfg_frame_dur_to_frame_dur_us(ret);
+	} else {
+		LOG_ERR("Frame duration not set, cannot start codec.");
+		return -EINVAL;
+	}
+
+	params->octets_per_frame = bt_audio_codec_cfg_get_octets_per_frame(codec_cfg);
+	params->frames_per_sdu = bt_audio_codec_cfg_get_frame_blocks_per_sdu(codec_cfg, true);
+
+	if (params->freq_hz < 0) {
+		LOG_ERR("Codec frequency not set, cannot start codec.");
+		return -EINVAL;
+	}
+
+	if (params->frame_duration_us < 0) {
+		LOG_ERR("Frame duration not set, cannot start codec.");
+		return -EINVAL;
+	}
+
+	if (params->octets_per_frame < 0) {
+		LOG_ERR("Octets per frame not set, cannot start codec.");
+		return -EINVAL;
+	}
+
+	params->num_samples =
+		((uint64_t)params->frame_duration_us * params->freq_hz) / USEC_PER_SEC;
+	if (params->num_samples > MAX_NUM_SAMPLES) {
+		LOG_ERR("Codec frame of %zu samples does not fit in PCM buffer",
+			params->num_samples);
+		return -EINVAL;
+	}
+
+	if (params->frames_per_sdu <= 0) {
+		LOG_ERR("Invalid number of codec frame blocks per SDU: %d", params->frames_per_sdu);
+		return -EINVAL;
+	}
+
+	params->sdu_len =
+		(size_t)params->octets_per_frame * STREAM_CHANNELS * params->frames_per_sdu;
+
+	return 0;
+}
+
+static void init_lc3_thread(void *arg1, void *arg2, void *arg3)
+{
+	int ret;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(codec_params); i++) {
+		ret = codec_params_parse(&broadcast_presets[i]->codec_cfg, &codec_params[i]);
+		if (ret != 0) {
+			return;
+		}
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		streams[i].codec = &codec_params[stream_preset_index(i)];
+	}
+
+#if !defined(CONFIG_USE_USB_AUDIO_INPUT)
+	/* If USB is not used as a sound source, generate a test signal */
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		const int freq_hz = streams[i].codec->freq_hz;
+
+		for (size_t j = 0U; j < STREAM_CHANNELS; j++) {
+			const uint32_t tone_hz = CONFIG_TONE_GENERATOR_FREQUENCY_HZ +
+						 (i * STREAM_CHANNELS + j) *
+							 CONFIG_TONE_GENERATOR_STREAM_STEP_HZ;
+
+			ret = tone_generator_init(&streams[i].tone[j], tone_hz, freq_hz);
+			if (ret != 0) {
+				LOG_ERR("Tone of %u Hz not supported at %d Hz: %d", tone_hz,
+					freq_hz, ret);
+				return;
+			}
+		}
+	}
+#endif
+
+	/* Create the encoder instances, each at the sample rate of its subgroup. This shall
+	 * complete before stream_started() is called.
+	 */
+	LOG_INF("LC3 encoder memory: %zu bytes per channel", sizeof(broadcast_lc3_encoder_mem_t));
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		const struct broadcast_codec_params *codec = streams[i].codec;
+
+		LOG_INF("Initializing lc3 encoder for stream %zu at %d Hz, %d octets", i,
+			codec->freq_hz, codec->octets_per_frame);
+		for (size_t j = 0U; j < STREAM_CHANNELS; j++) {
+			streams[i].lc3_encoder[j] =
+				lc3_setup_encoder(codec->frame_duration_us, codec->freq_hz, 0,
+						  &stream_storage[i].lc3_encoder_mem[j]);
+
+			if (streams[i].lc3_encoder[j] == NULL) {
+				LOG_ERR("Failed to setup LC3 encoder - wrong parameters?");
+			}
+		}
+	}
+
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	/* Hand each stream over to its own worker, so that a slow encode on one stream
+	 * does not delay the SDUs of the other streams. This thread becomes the worker of the
+	 * first stream rather than leaving its stack unused.
+	 */
+#if CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT > 1
+	for (size_t i = 1U; i < ARRAY_SIZE(streams); i++) {
+		k_thread_create(&stream_storage[i].encoder_thread, encoder_worker_stacks[i - 1U],
+				K_THREAD_STACK_SIZEOF(encoder_worker_stacks[i - 1U]),
+				encoder_worker_thread, &streams[i], NULL, NULL,
+				LC3_ENCODER_PRIORITY, 0, K_NO_WAIT);
+	}
+#endif /* CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT > 1 */
+
+	encoder_worker_thread(&streams[0], NULL, NULL);
+#else
+	while (true) {
+		for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+			k_sem_take(&lc3_encoder_sem, K_FOREVER);
+		}
+		for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+			send_data(&streams[i]);
+		}
+	}
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+}
+
+K_THREAD_DEFINE(encoder, LC3_ENCODER_STACK_SIZE, init_lc3_thread, NULL, NULL, NULL,
+		LC3_ENCODER_PRIORITY, 0, -1);
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+#if defined(CONFIG_USB_DRIFT_COMPENSATION) || defined(CONFIG_USB_AUDIO_UAC2)
+/* The ring buffer fill level is averaged over roughly 2^USB_DRIFT_FILTER_SHIFT USB
+ * frames, which smooths out the saw-tooth caused by the encoder pulling a whole SDU
+ * of audio at a time.
+ */
+#define USB_DRIFT_FILTER_SHIFT 7
+#define USB_DRIFT_TARGET_SAMPLES(_rate)                                                            \
+	((int32_t)(((USB_PREFILL_FRAMES * USB_FRAME_DURATION_US + MAX_SDU_DURATION_US / 2) *        \
+		    (_rate)) /                                                                     \
+		   USEC_PER_SEC))
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) || defined(CONFIG_USB_AUDIO_UAC2) */
+
+#if defined(CONFIG_USB_DRIFT_COMPENSATION)
+#define USB_DRIFT_DEADBAND_SAMPLES(_rate)                                                          \
+	((int32_t)((USB_FRAME_DURATION_US * (_rate)) / USEC_PER_SEC))
+
+/* Drift compensation state of the ring buffers fed at one sample rate */
+struct usb_drift {
+	int32_t fill_avg_q8;
+	int32_t target_samples;
+	int32_t deadband_samples;
+	uint32_t frames_since_correction;
+};
+
+static void usb_drift_init(struct usb_drift *drift, uint32_t sample_rate)
+{
+	drift->target_samples = USB_DRIFT_TARGET_SAMPLES(sample_rate);
+	drift->deadband_samples = USB_DRIFT_DEADBAND_SAMPLES(sample_rate);
+	drift->fill_avg_q8 = drift->target_samples << 8;
+	drift->frames_since_correction = 0U;
+}
+
+/**
+ * Track the fill level of the ring buffers to follow the drift between the USB host
+ * clock and the ISO interval.
+ *
+ * @param drift Drift compensation state of the ring buffers
+ * @param fill_bytes Current fill level of the ring buffers, in bytes
+ *
+ * @return 1 if a sample shall be inserted in this USB frame, -1 if one shall be dropped
+ *         and 0 if the frame shall be passed on unmodified.
+ */
+static int usb_drift_correction(struct usb_drift *drift, uint32_t fill_bytes)
+{
+	const int32_t fill = fill_bytes / USB_BYTES_PER_SAMPLE;
+	int32_t error;
+
+	drift->fill_avg_q8 += ((fill << 8) - drift->fill_avg_q8) >> USB_DRIFT_FILTER_SHIFT;
+
+	drift->frames_since_correction++;
+	if (drift->frames_since_correction * USB_FRAME_DURATION_US <
+	    CONFIG_USB_DRIFT_CORRECTION_INTERVAL_MS * USEC_PER_MSEC) {
+		return 0;
+	}
+
+	error = (drift->fill_avg_q8 >> 8) - drift->target_samples;
+	if (error > drift->deadband_samples) {
+		drift->frames_since_correction = 0U;
+		return -1;
+	} else if (error < -drift->deadband_samples) {
+		drift->frames_since_correction = 0U;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Add or remove one sample at the end of a block, replacing the last samples by their
+ * mid-point so that the correction does not introduce a step.
+ *
+ * @param buf Block of samples, with room for one extra sample
+ * @param nsamples Number of samples in the block, at least 2
+ * @param correction Value returned by usb_drift_correction()
+ *
+ * @return Number of samples in the block after the correction.
+ */
+static size_t usb_drift_apply(int16_t *buf, size_t nsamples, int correction)
+{
+	const int16_t mid = (int16_t)(((int32_t)buf[nsamples - 2] + buf[nsamples - 1]) / 2);
+
+	if (correction < 0) {
+		buf[nsamples - 2] = mid;
+		return nsamples - 1;
+	} else if (correction > 0) {
+		buf[nsamples] = buf[nsamples - 1];
+		buf[nsamples - 1] = mid;
+		return nsamples + 1;
+	}
+
+	return nsamples;
+}
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) */
+
+#if defined(CONFIG_USB_AUDIO_UAC2)
+/* Samples per USB frame at the nominal rate, in the Q10.14 feedback format of a
+ * full-speed device
+ */
+#define USB_FEEDBACK_NOMINAL                                                                       \
+	((uint32_t)((USB_SAMPLE_RATE * USB_FRAME_DURATION_US) / USEC_PER_SEC) << 14)
+/* Bound of the requested deviation, 1/8 sample per frame, well beyond any clock error */
+#define USB_FEEDBACK_RANGE   ((int32_t)BIT(14) / 8)
+
+/* Averaged fill level of the first ring buffer of the primary preset, in samples in Q8 */
+static int32_t usb_feedback_fill_q8;
+
+static void usb_feedback_update(uint32_t fill_bytes)
+{
+	const int32_t fill = fill_bytes / USB_BYTES_PER_SAMPLE;
+
+	usb_feedback_fill_q8 += ((fill << 8) - usb_feedback_fill_q8) >> USB_DRIFT_FILTER_SHIFT;
+}
+
+/* Have the host send faster while the ring buffers are below their nominal fill level,
+ * and slower while they are above it.
+ */
+static uint32_t usb_feedback(void)
+{
+	/* Fill level error in samples at the USB rate, in Q8 */
+	const int32_t error_q8 =
+		((USB_DRIFT_TARGET_SAMPLES(USB_DOWNSAMPLE_RATE) << 8) - usb_feedback_fill_q8) *
+		(USB_SAMPLE_RATE / USB_DOWNSAMPLE_RATE);
+	const int32_t adjust = (error_q8 << 6) >> CONFIG_USB_UAC2_FEEDBACK_SHIFT;
+
+	return USB_FEEDBACK_NOMINAL + CLAMP(adjust, -USB_FEEDBACK_RANGE, USB_FEEDBACK_RANGE);
+}
+#endif /* defined(CONFIG_USB_AUDIO_UAC2) */
+
+/* USB input resampled to the sample rate of one preset. The USB stream is decimated
+ * once per preset, and the result is shared by all streams of the subgroups using it.
+ */
+static struct usb_input {
+	/* Anti-aliasing decimator state, one per USB channel */
+	struct decimator decimators[USB_CHANNELS];
+#if defined(CONFIG_USB_DRIFT_COMPENSATION)
+	struct usb_drift drift;
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) */
+} usb_inputs[BROADCAST_PRESET_COUNT];
+
+static const uint32_t usb_input_rates[BROADCAST_PRESET_COUNT] = {
+	BROADCAST_SAMPLE_RATE,
+#if defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP)
+	SECONDARY_SAMPLE_RATE,
+#endif /* defined(CONFIG_BROADCAST_SECONDARY_SUBGROUP) */
+};
+
+/**
+ * Find the next ring buffer fed by a USB channel resampled for a preset.
+ *
+ * @param preset Preset index
+ * @param channel USB channel
+ * @param[in,out] pos Flat index into the stream channels to search from, moved past the
+ *		      ring buffer found
+ *
+ * @return The ring buffer, or NULL if there are no more.
+ */
+static struct ring_buf *usb_ring_next(size_t preset, size_t channel, size_t *pos)
+{
+	for (; *pos < ARRAY_SIZE(streams) * STREAM_CHANNELS; (*pos)++) {
+		const size_t i = *pos / STREAM_CHANNELS;
+		const size_t j = *pos % STREAM_CHANNELS;
+
+		if (stream_preset_index(i) == preset &&
+		    STREAM_INPUT_CHANNEL(i % STREAMS_PER_SUBGROUP, j) == channel) {
+			(*pos)++;
+			return &streams[i].audio_ring_buf[j];
+		}
+	}
+
+	return NULL;
+}
+
+static void usb_ring_put(size_t stream, struct ring_buf *rb, const int16_t *data, size_t nsamples)
+{
+	const uint32_t size = nsamples * USB_BYTES_PER_SAMPLE;
+	const uint32_t size_put = ring_buf_put(rb, (const uint8_t *)data, size);
+
+	if (size_put < size) {
+		streams[stream].stats.overrun_bytes += size - size_put;
+		LOG_RATELIMIT(LOG_WRN,
+			      "Not enough room for samples in stream %zu "
+			      "buffer: %u bytes dropped (total %u), total capacity: %u",
+			      stream, size - size_put, streams[stream].stats.overrun_bytes,
+			      ring_buf_capacity_get(rb));
+	}
+}
+
+/**
+ * Decimate the audio of one USB frame into the ring buffers of the streams.
+ *
+ * @param data Interleaved stereo samples, USB_SUBSLOT_SIZE bytes each
+ * @param size Size of @p data in bytes
+ */
+static void usb_audio_process(const uint8_t *data, size_t size)
+{
+	static int count;
+	const pipeline_timestamp_t start_timestamp = pipeline_timing_now();
+	const int16_t *pcm;
+	size_t nsamples_in;
+	/* Used when a channel cannot be decimated straight into a ring buffer. One extra
+	 * sample to make room for drift correction.
+	 */
+	int16_t usb_pcm_data[DECIMATOR_MAX_OUTPUT_SAMPLES(
+		DECIMATOR_MAX_INPUT_SAMPLES, USB_SAMPLE_RATE / USB_DOWNSAMPLE_RATE) + 1];
+
+	/* 'size' is in bytes, containing 1ms, 48kHz, stereo. Deinterleave each channel
+	 * and low-pass filter it while downsampling to 16kHz/24Khz matching each
+	 * broadcast preset.
+	 */
+	nsamples_in = MIN(size / (USB_SUBSLOT_SIZE * USB_CHANNELS), DECIMATOR_MAX_INPUT_SAMPLES);
+
+#if USB_SUBSLOT_SIZE > 2
+	/* Only called from the USB stack thread. The codec takes 16-bit samples, so only
+	 * the most significant bits, at the end of each little endian subslot, are kept.
+	 */
+	static int16_t usb_pcm16[DECIMATOR_MAX_INPUT_SAMPLES * USB_CHANNELS];
+
+	for (size_t i = 0U; i < nsamples_in * USB_CHANNELS; i++) {
+		usb_pcm16[i] = (int16_t)sys_get_le16(&data[i * USB_SUBSLOT_SIZE +
+							   USB_SUBSLOT_SIZE - 2U]);
+	}
+	pcm = usb_pcm16;
+#else
+	pcm = (const int16_t *)data;
+#endif /* USB_SUBSLOT_SIZE > 2 */
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	/* Nothing reads the ring buffers while the BIG is suspended */
+	if (atomic_get(&suspended)) {
+		if (!pcm_quiet(pcm, nsamples_in * USB_CHANNELS)) {
+			broadcast_request(BROADCAST_REQUEST_RESUME);
+		}
+
+		return;
+	}
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+#if defined(CONFIG_USB_AUDIO_UAC2)
+	usb_feedback_update(ring_buf_size_get(&streams[0].audio_ring_buf[0]));
+#endif /* defined(CONFIG_USB_AUDIO_UAC2) */
+
+	for (size_t r = 0U; r < ARRAY_SIZE(usb_inputs); r++) {
+		struct usb_input *input = &usb_inputs[r];
+		const uint32_t size_max =
+			(DECIMATOR_MAX_OUTPUT_SAMPLES(nsamples_in, input->decimators[0].ratio) + 1U) *
+			USB_BYTES_PER_SAMPLE;
+
+#if defined(CONFIG_USB_DRIFT_COMPENSATION)
+		/* All channels get the same correction, so the streams stay aligned. Subgroup
+		 * r is the first one using preset r, its first stream is used as reference.
+		 */
+		const int correction = usb_drift_correction(
+			&input->drift,
+			ring_buf_size_get(&streams[r * STREAMS_PER_SUBGROUP].audio_ring_buf[0]));
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) */
+
+		for (size_t c = 0U; c < USB_CHANNELS; c++) {
+			size_t pos = 0U;
+			struct ring_buf *rb = usb_ring_next(r, c, &pos);
+			const size_t stream = (pos - 1U) / STREAM_CHANNELS;
+			int16_t *out = usb_pcm_data;
+			bool direct = false;
+			size_t nsamples;
+
+			/* The first ring buffer playing the channel is written in place, unless
+			 * the free space wraps around within the block.
+			 */
+			if (rb != NULL) {
+				uint8_t *data;
+
+				direct = ring_buf_put_claim(rb, &data, size_max) == size_max;
+				if (direct) {
+					out = (int16_t *)data;
+				} else {
+					(void)ring_buf_put_finish(rb, 0U);
+				}
+			}
+
+			nsamples = decimator_process(&input->decimators[c], &pcm[c], USB_CHANNELS,
+						     nsamples_in, out);
+
+#if defined(CONFIG_USB_DRIFT_COMPENSATION)
+			if (correction != 0 && nsamples >= 2U) {
+				nsamples = usb_drift_apply(out, nsamples, correction);
+			}
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) */
+
+			if (rb == NULL) {
+				continue;
+			}
+
+			if (direct) {
+				(void)ring_buf_put_finish(rb, nsamples * USB_BYTES_PER_SAMPLE);
+			} else {
+				usb_ring_put(stream, rb, out, nsamples);
+			}
+
+			/* Other subgroups of the preset playing the same channel get a copy */
+			while ((rb = usb_ring_next(r, c, &pos)) != NULL) {
+				usb_ring_put((pos - 1U) / STREAM_CHANNELS, rb, out, nsamples);
+			}
+		}
+	}
+
+	count++;
+	if ((count % 1000) == 0) {
+		LOG_INF("USB Data received (count = %d)", count);
+	}
+
+	pipeline_timing_record(PIPELINE_TIMING_USB_CALLBACK, start_timestamp);
+}
+
+#if defined(CONFIG_USB_AUDIO_LEGACY)
+static void data_received(const struct device *dev, struct net_buf *buffer, size_t size)
+{
+	if (!buffer) {
+		return;
+	}
+
+	if (size) {
+		usb_audio_process(net_buf_pull_mem(buffer, size), size);
+	}
+
+	net_buf_unref(buffer);
+}
+
+static const struct usb_audio_ops ops = {.data_received_cb = data_received};
+#else
+static const struct usb_uac2_cb uac2_cb = {
+	.data_received = usb_audio_process,
+	.feedback = usb_feedback,
+};
+#endif /* defined(CONFIG_USB_AUDIO_LEGACY) */
+
+/**
+ * Wait for the ring buffers to hold exactly the configured pre-fill.
+ *
+ * Audio buffered while the broadcast was being set up is dropped, and the SDUs used to
+ * fill the controller queue are sent as silence, so the ring buffers only add the
+ * pre-fill plus half a codec frame of latency on average.
+ */
+static void usb_audio_prefill(void)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		for (size_t j = 0U; j < STREAM_CHANNELS; j++) {
+			struct ring_buf *rb = &streams[i].audio_ring_buf[j];
+
+			(void)ring_buf_get(rb, NULL, ring_buf_size_get(rb));
+		}
+		streams[i].silent_frames = BROADCAST_ENQUEUE_COUNT;
+	}
+
+	/* Do not hold up the broadcast if the host is not streaming */
+	for (unsigned int i = 0U; i < USB_PREFILL_TIMEOUT_MS; i++) {
+		if (ring_buf_size_get(&streams[0].audio_ring_buf[0]) >= USB_PREFILL_BYTES) {
+			return;
+		}
+
+		k_sleep(K_MSEC(1));
+	}
+
+	LOG_WRN("No USB audio received, starting with empty ring buffers");
+}
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+#if CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S > 0
+static void stats_report_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(stats_report_work, stats_report_handler);
+
+/* SDUs sent by each stream up to the previous report */
+static size_t stats_report_sent[ARRAY_SIZE(streams)];
+
+/* Log the SDU rate of each stream against the ISO interval, and its error counters */
+static void stats_report_handler(struct k_work *work)
+{
+	const uint32_t expected = ((uint64_t)CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S *
+				   USEC_PER_SEC) / preset_active.qos.interval;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		const struct broadcast_source_stream_stats stats = streams[i].stats;
+		const size_t sent = streams[i].sent_cnt;
+
+		LOG_INF("Stream %zu: %zu/%u SDUs in %u s, underrun %u samples, overrun %u "
+			"bytes, late %u, dropped %u, send errors %u",
+			i, sent - stats_report_sent[i], expected,
+			CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S, stats.underrun_samples,
+			stats.overrun_bytes, stats.late_sdus, stats.dropped_sdus,
+			stats.send_errors);
+		stats_report_sent[i] = sent;
+	}
+
+	k_work_reschedule(&stats_report_work, K_SECONDS(CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S));
+}
+
+/* The counters of the streams restart along with the streams */
+static void stats_report_start(void)
+{
+	(void)memset(stats_report_sent, 0, sizeof(stats_report_sent));
+	k_work_reschedule(&stats_report_work, K_SECONDS(CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S));
+}
+#else
+static inline void stats_report_start(void)
+{
+}
+#endif /* CONFIG_BROADCAST_STATS_REPORT_INTERVAL_S > 0 */
+
+static void print_latency(void)
+{
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	/* The last SDU is encoded just in time rather than queued for a whole interval */
+	const uint32_t queue_us = (BROADCAST_ENQUEUE_COUNT - 1U) * preset_active.qos.interval +
+				  CONFIG_BROADCAST_JIT_MARGIN_US;
+#else
+	const uint32_t queue_us = BROADCAST_ENQUEUE_COUNT * preset_active.qos.interval;
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	const uint32_t ring_us =
+		USB_PREFILL_FRAMES * USB_FRAME_DURATION_US + preset_active.qos.interval / 2U;
+#else
+	const uint32_t ring_us = 0U;
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+	LOG_INF("USB to air latency: %u us (ring buffer %u us, %u queued SDUs %u us), "
+	        "max transport latency %u ms, presentation delay %u us",
+	        ring_us + queue_us, ring_us, BROADCAST_ENQUEUE_COUNT, queue_us,
+	        preset_active.qos.latency, preset_active.qos.pd);
+}
+
+/* LE 2M PHY: preamble, access address, PDU header and CRC around the BIS payload */
+#define BIS_PDU_OVERHEAD_OCTETS 11U
+#define BIS_PDU_MIC_OCTETS      4U
+#define PHY_2M_US_PER_OCTET     4U
+/* Minimum subevent spacing between two BIS PDUs */
+#define BIS_T_MSS_US            150U
+
+/**
+ * Log an estimate of the radio time taken by the BIG in each ISO interval.
+ *
+ * Every BIS is assumed to send its SDU in a single PDU, once plus once per
+ * retransmission. The controller may schedule differently, but the estimate shows which
+ * share of the ISO interval is left for the advertising and other traffic.
+ */
+static void print_airtime(void)
+{
+	const struct bt_bap_qos_cfg *qos = &preset_active.qos;
+	const uint32_t mic_octets = strlen(CONFIG_BROADCAST_CODE) > 0 ? BIS_PDU_MIC_OCTETS : 0U;
+	const uint32_t pdu_us =
+		(BIS_PDU_OVERHEAD_OCTETS + qos->sdu + mic_octets) * PHY_2M_US_PER_OCTET;
+	const uint32_t pdus = ARRAY_SIZE(streams) * (qos->rtn + 1U);
+	const uint32_t airtime_us = pdus * (pdu_us + BIS_T_MSS_US);
+
+	LOG_INF("BIG airtime: %zu BIS x %u transmissions x %u us = %u us of %u us ISO "
+	        "interval (%u%%), %s packing",
+	        ARRAY_SIZE(streams), qos->rtn + 1U, pdu_us + BIS_T_MSS_US, airtime_us,
+	        qos->interval, (airtime_us * 100U) / qos->interval,
+	        BROADCAST_PACKING == BT_ISO_PACKING_INTERLEAVED ? "interleaved" : "sequential");
+	if (airtime_us > qos->interval) {
+		LOG_WRN("BIG does not fit in the ISO interval, reduce CONFIG_BROADCAST_RTN");
+	}
+}
+
+static void stream_started_cb(struct bt_bap_stream *stream)
+{
+	struct broadcast_source_stream *source_stream =
+		CONTAINER_OF(stream, struct broadcast_source_stream, stream);
+
+	source_stream->seq_num = 0U;
+	source_stream->sent_cnt = 0U;
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	source_stream->quiet_sdus = 0U;
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+	(void)memset(&source_stream->stats, 0, sizeof(source_stream->stats));
+#if defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS)
+	big_tx_ref_reset();
+#endif /* defined(CONFIG_BROADCAST_TIMESTAMPED_SDUS) */
+	k_sem_give(&sem_started);
+}
+
+static void stream_stopped_cb(struct bt_bap_stream *stream, uint8_t reason)
+{
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	struct broadcast_source_stream *source_stream =
+		CONTAINER_OF(stream, struct broadcast_source_stream, stream);
+
+	k_timer_stop(&stream_storage_get(source_stream)->encode_timer);
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+
+	k_sem_give(&sem_stopped);
+}
+
+/* Record when an SDU of the stream left, the reference for the deadline of the next one */
+static void stream_sent_mark(struct broadcast_source_stream *source_stream)
+{
+	source_stream->sent_cycles = k_cycle_get_32();
+#if defined(CONFIG_PIPELINE_TIMING)
+	source_stream->sent_timestamp = pipeline_timing_now();
+#endif /* defined(CONFIG_PIPELINE_TIMING) */
+}
+
+static void stream_sent_cb(struct bt_bap_stream *stream)
+{
+	struct broadcast_source_stream *source_stream =
+		CONTAINER_OF(stream, struct broadcast_source_stream, stream);
+
+	/* The sent callback follows the BIG event the SDU went out in, which makes it the
+	 * reference for scheduling the SDU of the next event.
+	 */
+	stream_sent_mark(source_stream);
+	stream_sdu_schedule(source_stream);
+}
+
+static struct bt_bap_stream_ops stream_ops = {
+	.started = stream_started_cb, .stopped = stream_stopped_cb, .sent = stream_sent_cb};
+
+#if defined(CONFIG_BROADCAST_SOURCE_SHELL)
+#include <zephyr/shell/shell.h>
+
+/**
+ * Get a snapshot of the counters of a stream.
+ *
+ * @param index Index of the stream
+ * @param[out] stats Counters of the stream since it was started
+ *
+ * @return 0 on success, -EINVAL if there is no such stream.
+ */
+static int stream_stats_get(size_t index, struct broadcast_source_stream_stats *stats)
+{
+	if (index >= ARRAY_SIZE(streams)) {
+		return -EINVAL;
+	}
+
+	*stats = streams[index].stats;
 
-	octets_per_frame = bt_audio_codec_cfg_get_octets_per_frame(codec_cfg);
-	frames_per_sdu = bt_audio_codec_cfg_get_frame_blocks_per_sdu(codec_cfg, true);
+	return 0;
+}
 
-	if (freq_hz < 0) {
-		printk("Error: Codec frequency not set, cannot start codec.");
-		return;
+static void stream_stats_reset(void)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		(void)memset(&streams[i].stats, 0, sizeof(streams[i].stats));
 	}
+}
 
-	if (frame_duration_us < 0) {
-		printk("Error: Frame duration not set, cannot start codec.");
-		return;
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	if (argc > 1) {
+		if (strcmp(argv[1], "reset") != 0) {
+			shell_error(sh, "Unknown argument: %s", argv[1]);
+			return -EINVAL;
+		}
+
+		stream_stats_reset();
+		return 0;
 	}
 
-	if (octets_per_frame < 0) {
-		printk("Error: Octets per frame not set, cannot start codec.");
-		return;
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		struct broadcast_source_stream_stats stats;
+
+		(void)stream_stats_get(i, &stats);
+		shell_print(sh,
+			    "Stream %zu: sent %zu, underrun %u samples, overrun %u bytes, "
+			    "alloc waits %u, send errors %u, late %u, dropped %u",
+			    i, streams[i].sent_cnt, stats.underrun_samples, stats.overrun_bytes,
+			    stats.alloc_waits, stats.send_errors, stats.late_sdus,
+			    stats.dropped_sdus);
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+		shell_print(sh, "Stream %zu: silent for %u SDUs, %u sent from cache", i,
+			    streams[i].quiet_sdus, stats.cached_sdus);
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
 	}
 
-#if !defined(CONFIG_USB_DEVICE_AUDIO)
-	/* If USB is not used as a sound source, generate a sine wave */
-	fill_audio_buf_sin(send_pcm_data, frame_duration_us, AUDIO_TONE_FREQUENCY_HZ, freq_hz);
-#endif
+	return 0;
+}
 
-	/* Create the encoder instance. This shall complete before stream_started() is called. */
-	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-		printk("Initializing lc3 encoder for stream %zu\n", i);
-		streams[i].lc3_encoder = lc3_setup_encoder(frame_duration_us, freq_hz, 0,
-							   &streams[i].lc3_encoder_mem);
+static int cmd_name(const struct shell *sh, size_t argc, char **argv)
+{
+	size_t len;
 
-		if (streams[i].lc3_encoder == NULL) {
-			printk("ERROR: Failed to setup LC3 encoder - wrong parameters?\n");
-		}
+	k_mutex_lock(&settings_lock, K_FOREVER);
+	if (argc == 1) {
+		shell_print(sh, "%s", settings.name);
+		k_mutex_unlock(&settings_lock);
+		return 0;
 	}
 
-	while (true) {
-		for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-			k_sem_take(&lc3_encoder_sem, K_FOREVER);
-		}
-		for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-			send_data(&streams[i]);
-		}
+	len = strlen(argv[1]);
+	if (len < BT_AUDIO_BROADCAST_NAME_LEN_MIN || len > BROADCAST_NAME_LEN_MAX) {
+		shell_error(sh, "Name shall be %u to %u octets", BT_AUDIO_BROADCAST_NAME_LEN_MIN,
+			    (unsigned int)BROADCAST_NAME_LEN_MAX);
+		k_mutex_unlock(&settings_lock);
+		return -EINVAL;
 	}
-}
 
-#define LC3_ENCODER_STACK_SIZE 4 * 4096
-#define LC3_ENCODER_PRIORITY   5
+	(void)memcpy(settings.name, argv[1], len + 1U);
+	k_mutex_unlock(&settings_lock);
 
-K_THREAD_DEFINE(encoder, LC3_ENCODER_STACK_SIZE, init_lc3_thread, NULL, NULL, NULL,
-		LC3_ENCODER_PRIORITY, 0, -1);
+	return 0;
+}
 
-#if defined(CONFIG_USB_DEVICE_AUDIO)
-static void data_received(const struct device *dev, struct net_buf *buffer, size_t size)
+static int cmd_code(const struct shell *sh, size_t argc, char **argv)
 {
-	static int count;
-	int16_t *pcm;
-	int nsamples, ratio;
-	int16_t usb_pcm_data[USB_CHANNELS][USB_NUM_SAMPLES];
+	const size_t len = argc > 1 ? strlen(argv[1]) : 0U;
 
-	if (!buffer) {
-		return;
+	if (len > BT_ISO_BROADCAST_CODE_SIZE) {
+		shell_error(sh, "Broadcast Code shall be at most %u octets",
+			    BT_ISO_BROADCAST_CODE_SIZE);
+		return -EINVAL;
 	}
 
-	if (!size) {
-		net_buf_unref(buffer);
-		return;
+	k_mutex_lock(&settings_lock, K_FOREVER);
+	(void)memset(settings.code, 0, sizeof(settings.code));
+	if (len > 0U) {
+		(void)memcpy(settings.code, argv[1], len);
 	}
+	settings.code_len = len;
+	k_mutex_unlock(&settings_lock);
 
-	pcm = (int16_t *)net_buf_pull_mem(buffer, size);
-
-	/* 'size' is in bytes, containing 1ms, 48kHz, stereo, 2 bytes per sample.
-	 * Take left channel and do a simple downsample to 16kHz/24Khz
-	 * matching the broadcast preset.
-	 */
+	return 0;
+}
 
-	ratio = USB_SAMPLE_RATE / USB_DOWNSAMPLE_RATE;
-	nsamples = size / (sizeof(int16_t) * USB_CHANNELS * ratio);
-	for (size_t i = 0, j = 0; i < nsamples; i++, j += USB_CHANNELS * ratio) {
-		usb_pcm_data[0][i] = pcm[j];
-		usb_pcm_data[1][i] = pcm[j + 1];
-	}
-
-	for (size_t i = 0U; i < MIN(ARRAY_SIZE(streams), 2); i++) {
-		const uint32_t size_put =
-			ring_buf_put(&(streams[i].audio_ring_buf), (uint8_t *)(usb_pcm_data[i]),
-				     nsamples * USB_BYTES_PER_SAMPLE);
-		if (size_put < nsamples * USB_BYTES_PER_SAMPLE) {
-			printk("Not enough room for samples in %s buffer: %u < %u, total capacity: "
-			       "%u\n",
-			       i == 0 ? "left" : "right", size_put, nsamples * USB_BYTES_PER_SAMPLE,
-			       ring_buf_capacity_get(&(streams[i].audio_ring_buf)));
-		}
+static int cmd_qos(const struct shell *sh, size_t argc, char **argv)
+{
+	unsigned long rtn, latency_ms, pd_us;
+	int err = 0;
+
+	if (argc == 1) {
+		k_mutex_lock(&settings_lock, K_FOREVER);
+		shell_print(sh, "RTN %u, max transport latency %u ms, presentation delay %u us",
+			    settings.rtn, settings.latency_ms, settings.pd_us);
+		k_mutex_unlock(&settings_lock);
+		return 0;
 	}
 
-	count++;
-	if ((count % 1000) == 0) {
-		printk("USB Data received (count = %d)\n", count);
+	if (argc != 4) {
+		shell_error(sh, "Expected <rtn> <latency_ms> <pd_us>");
+		return -EINVAL;
 	}
 
-	net_buf_unref(buffer);
-}
-
-static const struct usb_audio_ops ops = {.data_received_cb = data_received};
-#endif /* defined(CONFIG_USB_DEVICE_AUDIO) */
+	rtn = shell_strtoul(argv[1], 10, &err);
+	latency_ms = shell_strtoul(argv[2], 10, &err);
+	pd_us = shell_strtoul(argv[3], 10, &err);
+	/* Same ranges as the Kconfig options */
+	if (err != 0 || rtn > 30U || latency_ms < 5U || latency_ms > 4000U ||
+	    pd_us > 0xFFFFFFU) {
+		shell_error(sh, "Invalid QoS, expected <rtn 0-30> <latency_ms 5-4000> <pd_us>");
+		return -EINVAL;
+	}
 
-static void stream_started_cb(struct bt_bap_stream *stream)
-{
-	struct broadcast_source_stream *source_stream =
-		CONTAINER_OF(stream, struct broadcast_source_stream, stream);
+	k_mutex_lock(&settings_lock, K_FOREVER);
+	settings.rtn = rtn;
+	settings.latency_ms = latency_ms;
+	settings.pd_us = pd_us;
+	k_mutex_unlock(&settings_lock);
 
-	source_stream->seq_num = 0U;
-	source_stream->sent_cnt = 0U;
-	k_sem_give(&sem_started);
+	return 0;
 }
 
-static void stream_stopped_cb(struct bt_bap_stream *stream, uint8_t reason)
+static int cmd_restart(const struct shell *sh, size_t argc, char **argv)
 {
-	k_sem_give(&sem_stopped);
-}
+	broadcast_request(BROADCAST_REQUEST_RESTART);
 
-static void stream_sent_cb(struct bt_bap_stream *stream)
-{
-	k_sem_give(&lc3_encoder_sem);
+	return 0;
 }
 
-static struct bt_bap_stream_ops stream_ops = {
-	.started = stream_started_cb, .stopped = stream_stopped_cb, .sent = stream_sent_cb};
-
-static int setup_broadcast_source(struct bt_bap_broadcast_source **source)
+SHELL_STATIC_SUBCMD_SET_CREATE(source_cmds,
+	SHELL_CMD_ARG(stats, NULL, "Show per-stream counters [reset]", cmd_stats, 1, 1),
+	SHELL_CMD_ARG(name, NULL, "Show or set the Broadcast Name [<name>]", cmd_name, 1, 1),
+	SHELL_CMD_ARG(code, NULL, "Set the Broadcast Code, none for no encryption [<code>]",
+		      cmd_code, 1, 1),
+	SHELL_CMD_ARG(qos, NULL, "Show or set the QoS [<rtn> <latency_ms> <pd_us>]",
+		      cmd_qos, 1, 3),
+	SHELL_CMD(restart, NULL, "Restart the broadcast with the new settings", cmd_restart),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(source, &source_cmds, "Broadcast source commands", NULL);
+#endif /* defined(CONFIG_BROADCAST_SOURCE_SHELL) */
+
+static int setup_broadcast_source(struct bt_bap_broadcast_source **source,
+				  const struct broadcast_settings *cfg)
 {
 	struct bt_bap_broadcast_source_stream_param
 		stream_params[CONFIG_BT_BAP_BROADCAST_SRC_STREAM_COUNT];
 	struct bt_bap_broadcast_source_subgroup_param
 		subgroup_param[CONFIG_BT_BAP_BROADCAST_SRC_SUBGROUP_COUNT];
 	struct bt_bap_broadcast_source_param create_param = {0};
-	const size_t streams_per_subgroup = ARRAY_SIZE(stream_params) / ARRAY_SIZE(subgroup_param);
+	const size_t streams_per_subgroup = STREAMS_PER_SUBGROUP;
 	int err;
 
 	for (size_t i = 0U; i < ARRAY_SIZE(subgroup_param); i++) {
 		subgroup_param[i].params_count = streams_per_subgroup;
 		subgroup_param[i].params = stream_params + i * streams_per_subgroup;
-		subgroup_param[i].codec_cfg = &preset_active.codec_cfg;
+		subgroup_param[i].codec_cfg =
+			&broadcast_presets[subgroup_preset_index(i)]->codec_cfg;
 	}
 
 	for (size_t j = 0U; j < ARRAY_SIZE(stream_params); j++) {
+		const size_t pos = j % streams_per_subgroup;
+
 		stream_params[j].stream = &streams[j].stream;
-		stream_params[j].data = j == 0 ? left_stream : right_stream;
-		stream_params[j].data_len = j == 0 ? sizeof(left_stream) : sizeof(right_stream);
+		stream_params[j].data = bis_codec_data[j];
+		stream_params[j].data_len = sizeof(bis_codec_data[j]);
 		bt_bap_stream_cb_register(stream_params[j].stream, &stream_ops);
+
+		LOG_INF("Stream %zu: subgroup %zu, location 0x%08x, %u channel(s)", j,
+			j / streams_per_subgroup, (unsigned int)STREAM_LOCATION(pos),
+			STREAM_CHANNELS);
 	}
 
 	create_param.params_count = ARRAY_SIZE(subgroup_param);
 	create_param.params = subgroup_param;
+	/* The BIG is set up from the primary preset, whose SDUs are the largest */
+	preset_active.qos.sdu = BROADCAST_MAX_SDU;
+	preset_active.qos.rtn = cfg->rtn;
+	preset_active.qos.latency = cfg->latency_ms;
+	preset_active.qos.pd = cfg->pd_us;
 	create_param.qos = &preset_active.qos;
-	create_param.encryption = strlen(CONFIG_BROADCAST_CODE) > 0;
-	create_param.packing = BT_ISO_PACKING_SEQUENTIAL;
+	create_param.encryption = cfg->code_len > 0U;
+	create_param.packing = BROADCAST_PACKING;
 
 	if (create_param.encryption) {
-		memcpy(create_param.broadcast_code, CONFIG_BROADCAST_CODE,
-		       strlen(CONFIG_BROADCAST_CODE));
+		memcpy(create_param.broadcast_code, cfg->code, cfg->code_len);
 	}
 
-	printk("Creating broadcast source with %zu subgroups with %zu streams\n",
-	       ARRAY_SIZE(subgroup_param), ARRAY_SIZE(subgroup_param) * streams_per_subgroup);
+	LOG_INF("Creating broadcast source with %zu subgroups with %zu streams",
+	        ARRAY_SIZE(subgroup_param), ARRAY_SIZE(subgroup_param) * streams_per_subgroup);
 
 	err = bt_bap_broadcast_source_create(&create_param, source);
 	if (err != 0) {
-		printk("Unable to create broadcast source: %d\n", err);
+		LOG_ERR("Unable to create broadcast source: %d", err);
+		return err;
+	}
+
+	return 0;
+}
+
+/* Create the broadcast source from the current settings and advertise it */
+static int broadcast_create(struct bt_le_ext_adv *adv, uint32_t broadcast_id)
+{
+	/* Broadcast Audio Streaming Endpoint advertising data */
+	NET_BUF_SIMPLE_DEFINE(ad_buf, BT_UUID_SIZE_16 + BT_AUDIO_BROADCAST_ID_SIZE);
+	NET_BUF_SIMPLE_DEFINE(base_buf, 128);
+	struct bt_data ext_ad[EXT_AD_COUNT];
+	struct bt_data per_ad[PER_AD_COUNT];
+	struct broadcast_settings cfg;
+	size_t per_ad_len;
+	int err;
+
+	k_mutex_lock(&settings_lock, K_FOREVER);
+	cfg = settings;
+	k_mutex_unlock(&settings_lock);
+
+	LOG_INF("Creating broadcast source %s%s", cfg.name,
+		cfg.code_len > 0U ? " (encrypted)" : "");
+	err = setup_broadcast_source(&broadcast_source, &cfg);
+	if (err != 0) {
+		LOG_ERR("Unable to setup broadcast source: %d", err);
+		return err;
+	}
+
+	/* Setup extended advertising data */
+	net_buf_simple_add_le16(&ad_buf, BT_UUID_BROADCAST_AUDIO_VAL);
+	net_buf_simple_add_le24(&ad_buf, broadcast_id);
+	ext_ad[0].type = BT_DATA_SVC_DATA16;
+	ext_ad[0].data_len = ad_buf.len;
+	ext_ad[0].data = ad_buf.data;
+	ext_ad[1] = (struct bt_data)BT_DATA(BT_DATA_BROADCAST_NAME, cfg.name, strlen(cfg.name));
+#if defined(CONFIG_BROADCAST_VENDOR_AD)
+	ext_ad[2] = (struct bt_data)BT_DATA(BT_DATA_MANUFACTURER_DATA, &vendor_ad, sizeof(vendor_ad));
+#endif /* defined(CONFIG_BROADCAST_VENDOR_AD) */
+
+	err = bt_le_ext_adv_set_data(adv, ext_ad, ARRAY_SIZE(ext_ad), NULL, 0);
+	if (err != 0) {
+		LOG_ERR("Failed to set extended advertising data: %d", err);
+		return err;
+	}
+
+	/* Setup periodic advertising data */
+	err = bt_bap_broadcast_source_get_base(broadcast_source, &base_buf);
+	if (err != 0) {
+		LOG_ERR("Failed to get encoded BASE: %d", err);
+		return err;
+	}
+
+	per_ad[0].type = BT_DATA_SVC_DATA16;
+	per_ad[0].data_len = base_buf.len;
+	per_ad[0].data = base_buf.data;
+#if defined(CONFIG_BROADCAST_VENDOR_AD)
+	per_ad[1] = (struct bt_data)BT_DATA(BT_DATA_MANUFACTURER_DATA, &vendor_per_ad_info,
+					    sizeof(vendor_per_ad_info));
+#if defined(CONFIG_BROADCAST_VENDOR_PA_STREAM_INFO)
+	per_ad[2] = (struct bt_data)BT_DATA(BT_DATA_MANUFACTURER_DATA, &vendor_per_ad_stream,
+					    sizeof(vendor_per_ad_stream));
+#endif /* defined(CONFIG_BROADCAST_VENDOR_PA_STREAM_INFO) */
+#endif /* defined(CONFIG_BROADCAST_VENDOR_AD) */
+
+	per_ad_len = AD_STRUCT_SIZE(base_buf.len) + VENDOR_PER_AD_LEN;
+	if (per_ad_len > CONFIG_BROADCAST_ADV_DATA_LEN_MAX) {
+		LOG_ERR("Periodic advertising data of %zu octets exceeds %u", per_ad_len,
+			CONFIG_BROADCAST_ADV_DATA_LEN_MAX);
+		return -ENOMEM;
+	}
+
+	LOG_INF("Advertising data: %zu octets extended, %zu octets periodic",
+		EXT_AD_LEN(strlen(cfg.name)), per_ad_len);
+
+	err = bt_le_per_adv_set_data(adv, per_ad, ARRAY_SIZE(per_ad));
+	if (err != 0) {
+		LOG_ERR("Failed to set periodic advertising data: %d", err);
+		return err;
+	}
+
+	return 0;
+}
+
+/* Drop the SDU requests left over from a previous BIG */
+static void encoder_requests_flush(void)
+{
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		while (k_sem_take(&streams[i].encoder_sem, K_NO_WAIT) == 0) {
+		}
+	}
+#else
+	while (k_sem_take(&lc3_encoder_sem, K_NO_WAIT) == 0) {
+	}
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+}
+
+static int broadcast_start(struct bt_le_ext_adv *adv)
+{
+	int err;
+
+	LOG_INF("Starting broadcast source");
+	err = bt_bap_broadcast_source_start(broadcast_source, adv);
+	if (err != 0) {
+		LOG_ERR("Unable to start broadcast source: %d", err);
+		return err;
+	}
+
+	/* Wait for all to be started */
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		k_sem_take(&sem_started, K_FOREVER);
+	}
+	LOG_INF("Broadcast source started");
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	usb_audio_prefill();
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+	print_latency();
+	print_airtime();
+	pipeline_timing_init(preset_active.qos.interval);
+	stats_report_start();
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+	quiet_hold_sdus = DIV_ROUND_UP(CONFIG_BROADCAST_SILENCE_HOLD_MS * USEC_PER_MSEC,
+				       preset_active.qos.interval);
+	quiet_suspend_sdus = ((uint64_t)CONFIG_BROADCAST_SUSPEND_TIMEOUT_S * USEC_PER_SEC) /
+			     preset_active.qos.interval;
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+	encoder_requests_flush();
+	/* A suspend requested by SDUs of the previous BIG is stale */
+	atomic_clear_bit(broadcast_requests, BROADCAST_REQUEST_SUSPEND);
+	atomic_set(&broadcasting, 1);
+
+	/* Initialize sending */
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		for (unsigned int j = 0U; j < BROADCAST_ENQUEUE_COUNT; j++) {
+			stream_sent_mark(&streams[i]);
+			stream_sdu_request(&streams[i]);
+		}
+	}
+
+	return 0;
+}
+
+/* Stop the broadcast source, the advertising set keeps running */
+static int broadcast_stop(void)
+{
+	int err;
+
+	atomic_clear(&broadcasting);
+
+	LOG_INF("Stopping broadcast source");
+	err = bt_bap_broadcast_source_stop(broadcast_source);
+	if (err != 0) {
+		LOG_ERR("Unable to stop broadcast source: %d", err);
 		return err;
 	}
 
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		k_sem_take(&sem_stopped, K_FOREVER);
+	}
+
 	return 0;
 }
 
+/*
+ * Wait for one of the requests in @p mask. The restart request is raised by the timeout
+ * as well.
+ */
+static void broadcast_request_wait(atomic_val_t mask, k_timeout_t timeout)
+{
+	const k_timepoint_t end = sys_timepoint_calc(timeout);
+
+	while ((atomic_get(broadcast_requests) & mask) == 0) {
+		if (k_sem_take(&control_sem, sys_timepoint_timeout(end)) != 0) {
+			atomic_set_bit(broadcast_requests, BROADCAST_REQUEST_RESTART);
+		}
+	}
+}
+
 int main(void)
 {
 	struct bt_le_ext_adv *adv;
+	uint32_t broadcast_id;
+	int64_t restart_ms = -1;
 	int err;
 
 	err = bt_enable(NULL);
 	if (err) {
-		printk("Bluetooth init failed (err %d)\n", err);
+		LOG_ERR("Bluetooth init failed (err %d)", err);
 		return 0;
 	}
-	printk("Bluetooth initialized\n");
+	LOG_INF("Bluetooth initialized");
+
+#if defined(CONFIG_USE_USB_AUDIO_INPUT)
+	(void)memset(streams, 0, sizeof(streams));
 
-	for (size_t i = 0U; i < ARRAY_SIZE(send_pcm_data); i++) {
-		/* Initialize mock data */
-		send_pcm_data[i] = i;
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		for (size_t j = 0U; j < STREAM_CHANNELS; j++) {
+			ring_buf_init(&(streams[i].audio_ring_buf[j]),
+				      sizeof(stream_storage[i].ring_buffer_memory[j]),
+				      stream_storage[i].ring_buffer_memory[j]);
+		}
+		LOG_INF("Initialized ring buf %zu: capacity: %u", i,
+		        ring_buf_capacity_get(&(streams[i].audio_ring_buf[0])));
 	}
 
-#if defined(CONFIG_USB_DEVICE_AUDIO)
-	const struct device *hs_dev;
+	for (size_t i = 0U; i < ARRAY_SIZE(usb_inputs); i++) {
+		for (size_t j = 0U; j < USB_CHANNELS; j++) {
+			err = decimator_init(&usb_inputs[i].decimators[j],
+					     USB_SAMPLE_RATE / usb_input_rates[i]);
+			if (err != 0) {
+				LOG_ERR("Failed to initialize decimator %zu of input %zu (%d)", j,
+					i, err);
+				return 0;
+			}
+		}
+#if defined(CONFIG_USB_DRIFT_COMPENSATION)
+		usb_drift_init(&usb_inputs[i].drift, usb_input_rates[i]);
+#endif /* defined(CONFIG_USB_DRIFT_COMPENSATION) */
+	}
 
-	hs_dev = DEVICE_DT_GET(DT_NODELABEL(hs_0));
+#if defined(CONFIG_USB_AUDIO_LEGACY)
+	const struct device *hp_dev = DEVICE_DT_GET(DT_NODELABEL(hp_0));
 
-	if (!device_is_ready(hs_dev)) {
-		printk("Device USB Headset is not ready\n");
+	if (!device_is_ready(hp_dev)) {
+		LOG_ERR("Device USB Headphones is not ready");
 		return 0;
 	}
 
-	printk("Found USB Headset Device\n");
+	LOG_INF("Found USB Headphones Device");
 
-	(void)memset(streams, 0, sizeof(streams));
-
-	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-		ring_buf_init(&(streams[i].audio_ring_buf), sizeof(streams[i]._ring_buffer_memory),
-			      streams[i]._ring_buffer_memory);
-		printk("Initialized ring buf %zu: capacity: %u\n", i,
-		       ring_buf_capacity_get(&(streams[i].audio_ring_buf)));
-	}
-
-	usb_audio_register(hs_dev, &ops);
+	usb_audio_register(hp_dev, &ops);
 
 	err = usb_enable(NULL);
 	if (err && err != -EALREADY) {
-		printk("Failed to enable USB (%d)", err);
+		LOG_ERR("Failed to enable USB (%d)", err);
 		return 0;
 	}
+#else
+	usb_feedback_fill_q8 = USB_DRIFT_TARGET_SAMPLES(USB_DOWNSAMPLE_RATE) << 8;
 
-#endif /* defined(CONFIG_USB_DEVICE_AUDIO) */
-	k_thread_start(encoder);
+	err = usb_uac2_init(&uac2_cb);
+	if (err != 0) {
+		return 0;
+	}
+#endif /* defined(CONFIG_USB_AUDIO_LEGACY) */
 
-	/* Broadcast Audio Streaming Endpoint advertising data */
-	NET_BUF_SIMPLE_DEFINE(ad_buf, BT_UUID_SIZE_16 + BT_AUDIO_BROADCAST_ID_SIZE);
-	NET_BUF_SIMPLE_DEFINE(base_buf, 128);
-	struct bt_data ext_ad[3];
-	struct bt_data per_ad[3];
-	uint32_t broadcast_id;
+#endif /* defined(CONFIG_USE_USB_AUDIO_INPUT) */
+
+#if defined(CONFIG_ENCODER_THREAD_PER_STREAM)
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		k_sem_init(&streams[i].encoder_sem, 0U, BROADCAST_ENQUEUE_COUNT);
+	}
+#endif /* defined(CONFIG_ENCODER_THREAD_PER_STREAM) */
+
+#if defined(CONFIG_BROADCAST_JIT_ENCODE)
+	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
+		k_timer_init(&stream_storage[i].encode_timer, encode_timer_expired, NULL);
+		k_timer_user_data_set(&stream_storage[i].encode_timer, &streams[i]);
+	}
+#endif /* defined(CONFIG_BROADCAST_JIT_ENCODE) */
+
+	k_thread_start(encoder);
 
 	/* Create a connectable advertising set */
 	err = bt_le_ext_adv_create(BT_LE_EXT_ADV_CUSTOM, NULL, &adv);
 	if (err != 0) {
-		printk("Unable to create extended advertising set: %d\n", err);
+		LOG_ERR("Unable to create extended advertising set: %d", err);
 		return 0;
 	}
 
 	/* Set periodic advertising parameters */
 	err = bt_le_per_adv_set_param(adv, BT_LE_PER_ADV_DEFAULT);
 	if (err) {
-		printk("Failed to set periodic advertising parameters (err %d)\n", err);
-		return 0;
-	}
-
-	printk("Creating broadcast source\n");
-	err = setup_broadcast_source(&broadcast_source);
-	if (err != 0) {
-		printk("Unable to setup broadcast source: %d\n", err);
+		LOG_ERR("Failed to set periodic advertising parameters (err %d)", err);
 		return 0;
 	}
 
@@ -552,80 +2248,89 @@ int main(void)
 #else
 	err = bt_rand(&broadcast_id, BT_AUDIO_BROADCAST_ID_SIZE);
 	if (err) {
-		printk("Unable to generate broadcast ID: %d\n", err);
+		LOG_ERR("Unable to generate broadcast ID: %d", err);
 		return err;
 	}
 #endif /* CONFIG_STATIC_BROADCAST_ID */
 
-	/* Setup extended advertising data */
-	net_buf_simple_add_le16(&ad_buf, BT_UUID_BROADCAST_AUDIO_VAL);
-	net_buf_simple_add_le24(&ad_buf, broadcast_id);
-	ext_ad[0].type = BT_DATA_SVC_DATA16;
-	ext_ad[0].data_len = ad_buf.len;
-	ext_ad[0].data = ad_buf.data;
-	ext_ad[1] = (struct bt_data)BT_DATA(BT_DATA_BROADCAST_NAME, CONFIG_BT_DEVICE_NAME,
-						sizeof(CONFIG_BT_DEVICE_NAME) - 1);
-	ext_ad[2] = (struct bt_data) BT_DATA(BT_DATA_MANUFACTURER_DATA, ad_data_1, sizeof(ad_data_1));
-
-	err = bt_le_ext_adv_set_data(adv, ext_ad, ARRAY_SIZE(ext_ad), NULL, 0);
-	if (err != 0) {
-		printk("Failed to set extended advertising data: %d\n", err);
-		return 0;
-	}
-
-	/* Setup periodic advertising data */
-	err = bt_bap_broadcast_source_get_base(broadcast_source, &base_buf);
-	if (err != 0) {
-		printk("Failed to get encoded BASE: %d\n", err);
-		return 0;
-	}
-
-	per_ad[0].type = BT_DATA_SVC_DATA16;
-	per_ad[0].data_len = base_buf.len;
-	per_ad[0].data = base_buf.data;
-	per_ad[1] = (struct bt_data) BT_DATA(BT_DATA_MANUFACTURER_DATA, per_ad_data_1, sizeof(per_ad_data_1));
-	per_ad[2] = (struct bt_data) BT_DATA(BT_DATA_MANUFACTURER_DATA, per_ad_data_2, sizeof(per_ad_data_2));
-
-	err = bt_le_per_adv_set_data(adv, per_ad, ARRAY_SIZE(per_ad));
+	err = broadcast_create(adv, broadcast_id);
 	if (err != 0) {
-		printk("Failed to set periodic advertising data: %d\n", err);
 		return 0;
 	}
 
 	/* Start extended advertising */
 	err = bt_le_ext_adv_start(adv, BT_LE_EXT_ADV_START_DEFAULT);
 	if (err) {
-		printk("Failed to start extended advertising: %d\n", err);
+		LOG_ERR("Failed to start extended advertising: %d", err);
 		return 0;
 	}
 
 	/* Enable Periodic Advertising */
 	err = bt_le_per_adv_start(adv);
 	if (err) {
-		printk("Failed to enable periodic advertising: %d\n", err);
+		LOG_ERR("Failed to enable periodic advertising: %d", err);
 		return 0;
 	}
 
-	printk("Starting broadcast source\n");
-	err = bt_bap_broadcast_source_start(broadcast_source, adv);
-	if (err != 0) {
-		printk("Unable to start broadcast source: %d\n", err);
-		return 0;
-	}
+	/* The advertising set, the encoders and the TX pool are kept across restarts, only
+	 * the broadcast source is created again.
+	 */
+	while (true) {
+		err = broadcast_start(adv);
+		if (err != 0) {
+			return 0;
+		}
 
-	/* Wait for all to be started */
-	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-		k_sem_take(&sem_started, K_FOREVER);
-	}
-	printk("Broadcast source started\n");
+		if (restart_ms >= 0) {
+			LOG_INF("Broadcast source restarted in %u ms",
+				(uint32_t)(k_uptime_get() - restart_ms));
+		}
 
-	/* Initialize sending */
-	for (size_t i = 0U; i < ARRAY_SIZE(streams); i++) {
-		for (unsigned int j = 0U; j < BROADCAST_ENQUEUE_COUNT; j++) {
-			stream_sent_cb(&streams[i].stream);
+		broadcast_request_wait(BIT(BROADCAST_REQUEST_RESTART) |
+					       BIT(BROADCAST_REQUEST_SUSPEND),
+				       BROADCAST_RESTART_TIMEOUT);
+		restart_ms = k_uptime_get();
+
+		err = broadcast_stop();
+		if (err != 0) {
+			return 0;
+		}
+
+#if defined(CONFIG_BROADCAST_SILENCE_DETECT)
+		if (!atomic_test_bit(broadcast_requests, BROADCAST_REQUEST_RESTART)) {
+			atomic_clear_bit(broadcast_requests, BROADCAST_REQUEST_SUSPEND);
+			atomic_clear_bit(broadcast_requests, BROADCAST_REQUEST_RESUME);
+			atomic_set(&suspended, 1);
+			LOG_INF("Input silent, BIG suspended");
+
+			broadcast_request_wait(BIT(BROADCAST_REQUEST_RESUME) |
+						       BIT(BROADCAST_REQUEST_RESTART),
+					       K_FOREVER);
+			atomic_clear(&suspended);
+			atomic_clear_bit(broadcast_requests, BROADCAST_REQUEST_RESUME);
+			restart_ms = k_uptime_get();
+
+			/* The stopped source is started again as it is */
+			if (!atomic_test_bit(broadcast_requests, BROADCAST_REQUEST_RESTART)) {
+				continue;
+			}
+		}
+#endif /* defined(CONFIG_BROADCAST_SILENCE_DETECT) */
+
+		atomic_clear_bit(broadcast_requests, BROADCAST_REQUEST_RESTART);
+
+		err = bt_bap_broadcast_source_delete(broadcast_source);
+		if (err != 0) {
+			LOG_ERR("Unable to delete broadcast source: %d", err);
+			return 0;
+		}
+		broadcast_source = NULL;
+
+		err = broadcast_create(adv, broadcast_id);
+		if (err != 0) {
+			return 0;
 		}
 	}
 
-	k_sleep(K_FOREVER);
 	return 0;
 }
@@ -0,0 +1,117 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/timing/timing.h>
+
+#include "pipeline_timing.h"
+
+LOG_MODULE_REGISTER(pipeline_timing, LOG_LEVEL_INF);
+
+/* Power of two buckets in microseconds: [0, 1), [1, 2), [2, 4), ... [16384, inf) */
+#define HIST_BUCKETS 16
+
+struct pipeline_timing_stat {
+	uint32_t count;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t hist[HIST_BUCKETS];
+};
+
+static const char *const stat_names[PIPELINE_TIMING_COUNT] = {
+	[PIPELINE_TIMING_ENCODE] = "encode",
+	[PIPELINE_TIMING_ALLOC_TO_SEND] = "alloc to send",
+	[PIPELINE_TIMING_SENT_TO_SEND] = "sent to send",
+	[PIPELINE_TIMING_USB_CALLBACK] = "USB callback",
+};
+
+static struct pipeline_timing_stat stats[PIPELINE_TIMING_COUNT];
+static uint32_t cycles_per_us;
+static uint32_t budget_us;
+
+static void report_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(report_work, report_handler);
+
+static void stat_reset(struct pipeline_timing_stat *stat)
+{
+	(void)memset(stat, 0, sizeof(*stat));
+	stat->min_us = UINT32_MAX;
+}
+
+void pipeline_timing_record(enum pipeline_timing_id id, pipeline_timestamp_t start)
+{
+	const pipeline_timestamp_t end = timing_counter_get();
+	const uint32_t us = (uint32_t)(timing_cycles_get(&start, &end) / cycles_per_us);
+	struct pipeline_timing_stat *stat = &stats[id];
+	const size_t bucket = us == 0U ? 0U : MIN(32U - __builtin_clz(us), HIST_BUCKETS - 1U);
+	unsigned int key;
+
+	/* Records come from the encoder threads and the USB callback alike */
+	key = irq_lock();
+	stat->count++;
+	stat->sum_us += us;
+	stat->min_us = MIN(stat->min_us, us);
+	stat->max_us = MAX(stat->max_us, us);
+	stat->hist[bucket]++;
+	irq_unlock(key);
+}
+
+static void report_handler(struct k_work *work)
+{
+	struct pipeline_timing_stat snapshot[PIPELINE_TIMING_COUNT];
+	unsigned int key;
+
+	key = irq_lock();
+	memcpy(snapshot, stats, sizeof(snapshot));
+	for (size_t i = 0U; i < ARRAY_SIZE(stats); i++) {
+		stat_reset(&stats[i]);
+	}
+	irq_unlock(key);
+
+	LOG_INF("Pipeline timing over %u s (SDU interval %u us):",
+		CONFIG_PIPELINE_TIMING_REPORT_INTERVAL, budget_us);
+
+	for (size_t i = 0U; i < ARRAY_SIZE(snapshot); i++) {
+		const struct pipeline_timing_stat *stat = &snapshot[i];
+		char hist[HIST_BUCKETS * 11U];
+		size_t len = 0U;
+
+		if (stat->count == 0U) {
+			continue;
+		}
+
+		hist[0] = '\0';
+		for (size_t j = 0U; j < ARRAY_SIZE(stat->hist) && len < sizeof(hist); j++) {
+			len += snprintk(&hist[len], sizeof(hist) - len, " %u", stat->hist[j]);
+		}
+
+		LOG_INF("  %-13s n=%u min=%u avg=%u max=%u us, hist:%s", stat_names[i],
+			stat->count, stat->min_us, (uint32_t)(stat->sum_us / stat->count),
+			stat->max_us, hist);
+	}
+
+	k_work_reschedule(&report_work, K_SECONDS(CONFIG_PIPELINE_TIMING_REPORT_INTERVAL));
+}
+
+void pipeline_timing_init(uint32_t interval_us)
+{
+	timing_init();
+	timing_start();
+
+	cycles_per_us = MAX(timing_freq_get_mhz(), 1U);
+	budget_us = interval_us;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(stats); i++) {
+		stat_reset(&stats[i]);
+	}
+
+	k_work_reschedule(&report_work, K_SECONDS(CONFIG_PIPELINE_TIMING_REPORT_INTERVAL));
+}
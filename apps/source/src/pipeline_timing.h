@@ -0,0 +1,65 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PIPELINE_TIMING_H_
+#define PIPELINE_TIMING_H_
+
+#include <stdint.h>
+
+/** Hot-path durations tracked by the pipeline timing instrumentation */
+enum pipeline_timing_id {
+	/** PCM read and lc3_encode() of all frames of one SDU */
+	PIPELINE_TIMING_ENCODE,
+	/** TX buffer allocated until bt_bap_stream_send() returned */
+	PIPELINE_TIMING_ALLOC_TO_SEND,
+	/** Stream sent callback until the next SDU of that stream was sent */
+	PIPELINE_TIMING_SENT_TO_SEND,
+	/** USB audio data received callback */
+	PIPELINE_TIMING_USB_CALLBACK,
+
+	PIPELINE_TIMING_COUNT,
+};
+
+#if defined(CONFIG_PIPELINE_TIMING)
+#include <zephyr/timing/timing.h>
+
+typedef timing_t pipeline_timestamp_t;
+
+/**
+ * Start the cycle counter and the periodic report.
+ *
+ * @param interval_us SDU interval the durations are reported against
+ */
+void pipeline_timing_init(uint32_t interval_us);
+
+/**
+ * Record the time elapsed since @p start.
+ *
+ * @param id Duration being measured
+ * @param start Value returned by pipeline_timing_now() at the start of the measurement
+ */
+void pipeline_timing_record(enum pipeline_timing_id id, pipeline_timestamp_t start);
+
+static inline pipeline_timestamp_t pipeline_timing_now(void)
+{
+	return timing_counter_get();
+}
+#else
+typedef uint32_t pipeline_timestamp_t;
+
+static inline void pipeline_timing_init(uint32_t interval_us)
+{
+}
+
+static inline void pipeline_timing_record(enum pipeline_timing_id id, pipeline_timestamp_t start)
+{
+}
+
+static inline pipeline_timestamp_t pipeline_timing_now(void)
+{
+	return 0U;
+}
+#endif /* defined(CONFIG_PIPELINE_TIMING) */
+
+#endif /* PIPELINE_TIMING_H_ */
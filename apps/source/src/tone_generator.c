@@ -0,0 +1,136 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+#include <zephyr/sys_clock.h>
+
+#include "tone_generator.h"
+
+#define SINE_TABLE_BITS 8
+#define PHASE_FRAC_BITS (32 - SINE_TABLE_BITS)
+
+/* One period of sin() in Q15, with the first entry repeated at the end so that
+ * interpolation never has to wrap.
+ */
+static const int16_t sine_table[BIT(SINE_TABLE_BITS) + 1] = {
+	0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739,
+	9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+	18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811,
+	25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+	30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+	32609, 32678, 32728, 32757, 32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+	32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571, 30273, 29956, 29621, 29268,
+	28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+	23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151,
+	15446, 14732, 14010, 13279, 12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+	6393, 5602, 4808, 4011, 3212, 2410, 1608, 804, 0, -804, -1608, -2410,
+	-3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+	-12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159,
+	-20787, -21403, -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+	-27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113,
+	-31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+	-32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580,
+	-31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+	-27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+	-20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+	-12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011,
+	-3212, -2410, -1608, -804, 0,
+};
+
+#if defined(CONFIG_TONE_GENERATOR_MULTI_TONE)
+/* Additional tones of the multi-tone signal, as numerator/denominator of the base
+ * frequency. The ratios are not harmonic, so the sum does not repeat every period of
+ * the base tone.
+ */
+static const uint8_t multi_tone_ratios[TONE_GENERATOR_MAX_TONES - 1][2] = {
+	{8, 5},
+	{27, 10},
+};
+#endif /* defined(CONFIG_TONE_GENERATOR_MULTI_TONE) */
+
+static uint32_t phase_step(uint32_t frequency_hz, uint32_t sample_rate_hz)
+{
+	return (uint32_t)(((uint64_t)frequency_hz << 32) / sample_rate_hz);
+}
+
+static inline int32_t sine_q15(uint32_t phase)
+{
+	const uint32_t index = phase >> PHASE_FRAC_BITS;
+	const int32_t frac = (phase >> (PHASE_FRAC_BITS - 15)) & (BIT(15) - 1);
+	const int32_t a = sine_table[index];
+	const int32_t b = sine_table[index + 1];
+
+	return a + (((b - a) * frac) >> 15);
+}
+
+int tone_generator_init(struct tone_generator *gen, uint32_t frequency_hz,
+			uint32_t sample_rate_hz)
+{
+	if (frequency_hz == 0U || frequency_hz >= sample_rate_hz / 2U) {
+		return -EINVAL;
+	}
+
+	(void)memset(gen, 0, sizeof(*gen));
+
+	gen->step[0] = phase_step(frequency_hz, sample_rate_hz);
+	gen->num_tones = 1U;
+	gen->amplitude = TONE_GENERATOR_AMPLITUDE;
+
+#if defined(CONFIG_TONE_GENERATOR_MULTI_TONE)
+	for (size_t i = 0U; i < ARRAY_SIZE(multi_tone_ratios); i++) {
+		const uint32_t tone_hz =
+			(frequency_hz * multi_tone_ratios[i][0]) / multi_tone_ratios[i][1];
+
+		if (tone_hz >= sample_rate_hz / 2U) {
+			break;
+		}
+
+		gen->step[gen->num_tones++] = phase_step(tone_hz, sample_rate_hz);
+	}
+
+	gen->amplitude /= gen->num_tones;
+#elif defined(CONFIG_TONE_GENERATOR_SWEEP)
+	const uint32_t end_hz = MIN(CONFIG_TONE_GENERATOR_SWEEP_END_HZ, sample_rate_hz / 2U - 1U);
+	const uint32_t sweep_samples =
+		(uint32_t)(((uint64_t)CONFIG_TONE_GENERATOR_SWEEP_PERIOD_MS * sample_rate_hz) /
+			   MSEC_PER_SEC);
+
+	gen->step_min = MIN(gen->step[0], phase_step(end_hz, sample_rate_hz));
+	gen->step_max = MAX(gen->step[0], phase_step(end_hz, sample_rate_hz));
+	gen->step_delta = (int32_t)((gen->step_max - gen->step_min) / MAX(sweep_samples, 1U));
+	if (gen->step[0] == gen->step_max) {
+		gen->step_delta = -gen->step_delta;
+	}
+#endif /* defined(CONFIG_TONE_GENERATOR_MULTI_TONE) */
+
+	return 0;
+}
+
+void tone_generator_fill(struct tone_generator *gen, int16_t *buf, size_t num_samples)
+{
+	for (size_t i = 0U; i < num_samples; i++) {
+		int32_t sample = 0;
+
+		for (size_t j = 0U; j < gen->num_tones; j++) {
+			sample += sine_q15(gen->phase[j]);
+			gen->phase[j] += gen->step[j];
+		}
+
+		buf[i] = (int16_t)((sample * gen->amplitude) >> 15);
+
+#if defined(CONFIG_TONE_GENERATOR_SWEEP)
+		/* Sweep up and down, so the frequency never jumps either */
+		gen->step[0] += gen->step_delta;
+		if (gen->step[0] >= gen->step_max || gen->step[0] <= gen->step_min) {
+			gen->step[0] = CLAMP(gen->step[0], gen->step_min, gen->step_max);
+			gen->step_delta = -gen->step_delta;
+		}
+#endif /* defined(CONFIG_TONE_GENERATOR_SWEEP) */
+	}
+}
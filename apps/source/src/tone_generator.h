@@ -0,0 +1,55 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TONE_GENERATOR_H_
+#define TONE_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Peak amplitude of the generated signal. The codec does clipping above
+ * INT16_MAX - 3000.
+ */
+#define TONE_GENERATOR_AMPLITUDE (INT16_MAX - 3000)
+
+#define TONE_GENERATOR_MAX_TONES 3
+
+struct tone_generator {
+	/* Phase accumulators, a full period being 2^32 */
+	uint32_t phase[TONE_GENERATOR_MAX_TONES];
+	/* Phase increments per sample */
+	uint32_t step[TONE_GENERATOR_MAX_TONES];
+	size_t num_tones;
+	int16_t amplitude;
+	/* Sweep between step_min and step_max of the first tone, step_delta per sample */
+	uint32_t step_min;
+	uint32_t step_max;
+	int32_t step_delta;
+};
+
+/**
+ * Set up a test signal generator as selected by the TONE_GENERATOR_* Kconfig options.
+ *
+ * @param gen Generator instance
+ * @param frequency_hz Frequency of the tone, or start of the sweep
+ * @param sample_rate_hz Sample rate of the generated signal
+ *
+ * @return 0 on success, -EINVAL if the frequency is not below the Nyquist frequency.
+ */
+int tone_generator_init(struct tone_generator *gen, uint32_t frequency_hz,
+			uint32_t sample_rate_hz);
+
+/**
+ * Generate the next samples of the signal.
+ *
+ * Consecutive calls produce a phase-continuous signal, whatever the frequency and the
+ * block size.
+ *
+ * @param gen Generator instance
+ * @param buf Destination buffer
+ * @param num_samples Number of samples to generate
+ */
+void tone_generator_fill(struct tone_generator *gen, int16_t *buf, size_t num_samples);
+
+#endif /* TONE_GENERATOR_H_ */
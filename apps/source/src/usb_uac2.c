@@ -0,0 +1,150 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/usb/udc_buf.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/usb/class/usbd_uac2.h>
+#include <zephyr/usb/usbd.h>
+
+#include "usb_uac2.h"
+
+LOG_MODULE_REGISTER(usb_uac2, LOG_LEVEL_INF);
+
+#define UAC2_CHANNELS          2
+#define UAC2_SAMPLES_PER_FRAME 48
+/* Following the feedback, the host sends up to one sample per channel more than nominal */
+#define UAC2_BLOCK_SIZE_MAX    ((UAC2_SAMPLES_PER_FRAME + 1) * UAC2_CHANNELS * USB_UAC2_SUBSLOT_SIZE)
+/* Blocks are freed as soon as they are processed, so only a few are ever queued */
+#define UAC2_BLOCK_COUNT       3
+
+K_MEM_SLAB_DEFINE_STATIC(uac2_slab, ROUND_UP(UAC2_BLOCK_SIZE_MAX, UDC_BUF_GRANULARITY),
+			 UAC2_BLOCK_COUNT, UDC_BUF_ALIGN);
+
+USBD_DEVICE_DEFINE(uac2_usbd, DEVICE_DT_GET(DT_NODELABEL(zephyr_udc0)), CONFIG_USB_UAC2_VID,
+		   CONFIG_USB_UAC2_PID);
+USBD_DESC_LANG_DEFINE(uac2_lang);
+USBD_DESC_MANUFACTURER_DEFINE(uac2_manufacturer, "Zephyr");
+USBD_DESC_PRODUCT_DEFINE(uac2_product, CONFIG_USB_UAC2_PRODUCT);
+USBD_DESC_CONFIG_DEFINE(uac2_fs_config_desc, "FS Configuration");
+USBD_CONFIGURATION_DEFINE(uac2_fs_config, 0, 125, &uac2_fs_config_desc);
+
+static const struct usb_uac2_cb *app_cb;
+static bool streaming;
+
+static void uac2_sof(const struct device *dev, void *user_data)
+{
+	/* Blocks are processed as they are received, nothing is paced on SOF */
+}
+
+static void uac2_terminal_update(const struct device *dev, uint8_t terminal, bool enabled,
+				 bool microframes, void *user_data)
+{
+	streaming = enabled;
+	LOG_INF("USB audio streaming %s", enabled ? "started" : "stopped");
+}
+
+static void *uac2_get_recv_buf(const struct device *dev, uint8_t terminal, uint16_t size,
+			       void *user_data)
+{
+	void *buf;
+
+	if (!streaming || size > UAC2_BLOCK_SIZE_MAX) {
+		return NULL;
+	}
+
+	if (k_mem_slab_alloc(&uac2_slab, &buf, K_NO_WAIT) != 0) {
+		LOG_WRN("No USB audio buffer available");
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void uac2_data_recv(const struct device *dev, uint8_t terminal, void *buf, uint16_t size,
+			   void *user_data)
+{
+	if (size > 0U) {
+		app_cb->data_received(buf, size);
+	}
+
+	k_mem_slab_free(&uac2_slab, buf);
+}
+
+static uint32_t uac2_feedback(const struct device *dev, uint8_t terminal, void *user_data)
+{
+	return app_cb->feedback();
+}
+
+static const struct uac2_ops uac2_ops = {
+	.sof_cb = uac2_sof,
+	.terminal_update_cb = uac2_terminal_update,
+	.get_recv_buf = uac2_get_recv_buf,
+	.data_recv_cb = uac2_data_recv,
+	.feedback_cb = uac2_feedback,
+};
+
+int usb_uac2_init(const struct usb_uac2_cb *cb)
+{
+	const struct device *uac2_dev = DEVICE_DT_GET(DT_NODELABEL(uac2_headphones));
+	struct usbd_desc_node *const descs[] = {&uac2_lang, &uac2_manufacturer, &uac2_product};
+	int err;
+
+	if (!device_is_ready(uac2_dev)) {
+		LOG_ERR("USB Audio 2 device is not ready");
+		return -ENODEV;
+	}
+
+	app_cb = cb;
+	usbd_uac2_set_ops(uac2_dev, &uac2_ops, NULL);
+
+	for (size_t i = 0U; i < ARRAY_SIZE(descs); i++) {
+		err = usbd_add_descriptor(&uac2_usbd, descs[i]);
+		if (err != 0) {
+			LOG_ERR("Failed to add USB descriptor %zu (%d)", i, err);
+			return err;
+		}
+	}
+
+	err = usbd_add_configuration(&uac2_usbd, USBD_SPEED_FS, &uac2_fs_config);
+	if (err != 0) {
+		LOG_ERR("Failed to add USB configuration (%d)", err);
+		return err;
+	}
+
+	err = usbd_register_all_classes(&uac2_usbd, USBD_SPEED_FS, 1);
+	if (err != 0) {
+		LOG_ERR("Failed to register USB classes (%d)", err);
+		return err;
+	}
+
+	/* The audio control and streaming interfaces are grouped by an IAD */
+	err = usbd_device_set_code_triple(&uac2_usbd, USBD_SPEED_FS, USB_BCC_MISCELLANEOUS, 0x02,
+					  0x01);
+	if (err != 0) {
+		LOG_ERR("Failed to set USB device class (%d)", err);
+		return err;
+	}
+
+	err = usbd_init(&uac2_usbd);
+	if (err != 0) {
+		LOG_ERR("Failed to initialize USB device (%d)", err);
+		return err;
+	}
+
+	err = usbd_enable(&uac2_usbd);
+	if (err != 0) {
+		LOG_ERR("Failed to enable USB device (%d)", err);
+		return err;
+	}
+
+	return 0;
+}
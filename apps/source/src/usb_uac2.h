@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef USB_UAC2_H_
+#define USB_UAC2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/devicetree.h>
+
+/** Bytes per sample on the bus, 2, 3 or 4, as set in the devicetree */
+#define USB_UAC2_SUBSLOT_SIZE DT_PROP(DT_NODELABEL(as_iso_out), subslot_size)
+
+/** Callbacks of the application, called from the USB device stack thread */
+struct usb_uac2_cb {
+	/**
+	 * The audio of one USB frame was received.
+	 *
+	 * @param data Interleaved stereo samples, USB_UAC2_SUBSLOT_SIZE bytes each
+	 * @param size Size of @p data in bytes
+	 */
+	void (*data_received)(const uint8_t *data, size_t size);
+
+	/**
+	 * Get the number of samples the host shall send per USB frame.
+	 *
+	 * @return Samples per USB frame, in Q10.14.
+	 */
+	uint32_t (*feedback)(void);
+};
+
+/**
+ * Register the UAC2 headphones and enable the USB device.
+ *
+ * @param cb Application callbacks
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+int usb_uac2_init(const struct usb_uac2_cb *cb);
+
+#endif /* USB_UAC2_H_ */